@@ -97,3 +97,36 @@ func TestChunkedWrites(t *testing.T) {
 		t.Fatalf("chunked mismatch\nwant=%x\ngot =%x", full, got)
 	}
 }
+
+func TestTuning(t *testing.T) {
+	defer SetTuning(DefaultTuning())
+
+	input := patternBytes(300 * ChunkLen)
+	h := New()
+	_, _ = h.Write(input)
+	want := h.Sum256()
+
+	for _, tuning := range []Tuning{
+		{ParallelMinChunks: 1, MinChunksPerWorker: 1, MaxWorkers: 3},
+		{ParallelMinChunks: 16, MinChunksPerWorker: 64},
+		Calibrate(),
+	} {
+		SetTuning(tuning)
+		if got := Sum256(input); got != want {
+			t.Fatalf("tuning %+v mismatch\nwant=%x\ngot =%x", tuning, want, got)
+		}
+	}
+
+	path := t.TempDir() + "/tuning.json"
+	saved := Tuning{ParallelMinChunks: 64, MinChunksPerWorker: 16, MaxWorkers: 2}
+	if err := SaveTuning(path, saved); err != nil {
+		t.Fatalf("save tuning: %v", err)
+	}
+	loaded, err := LoadTuning(path)
+	if err != nil {
+		t.Fatalf("load tuning: %v", err)
+	}
+	if loaded != saved {
+		t.Fatalf("tuning round trip\nwant=%+v\ngot =%+v", saved, loaded)
+	}
+}
@@ -7,11 +7,9 @@ import (
 	"sync"
 )
 
-const parallelMinChunks = 128 // 128 KiB in 1 KiB chunks.
-
 var cvPool = sync.Pool{
 	New: func() any {
-		return make([][8]uint32, 0, parallelMinChunks)
+		return make([][8]uint32, 0, defaultParallelMinChunks)
 	},
 }
 
@@ -40,24 +38,25 @@ func sum256Fast(data []byte, keyWords [8]uint32, flags uint32) ([OutLen]byte, bo
 		return out, true
 	}
 
+	t := CurrentTuning()
 	if totalChunks <= maxChunkBatch {
 		var cvs [maxChunkBatch][8]uint32
-		fillChunkCVs(data, keyWords, flags, cvs[:totalChunks], fullChunks, rem)
+		fillChunkCVs(data, keyWords, flags, cvs[:totalChunks], fullChunks, rem, t)
 		reduceCVsToOutput(cvs[:totalChunks], keyWords, flags).rootBytes(out[:])
 		return out, true
 	}
 
 	cvs := getCVs(totalChunks)
-	fillChunkCVs(data, keyWords, flags, cvs[:totalChunks], fullChunks, rem)
+	fillChunkCVs(data, keyWords, flags, cvs[:totalChunks], fullChunks, rem, t)
 	reduceCVsToOutput(cvs[:totalChunks], keyWords, flags).rootBytes(out[:])
 	putCVs(cvs)
 	return out, true
 }
 
-func fillChunkCVs(data []byte, keyWords [8]uint32, flags uint32, cvs [][8]uint32, fullChunks, rem int) {
+func fillChunkCVs(data []byte, keyWords [8]uint32, flags uint32, cvs [][8]uint32, fullChunks, rem int, t Tuning) {
 	if fullChunks > 0 {
-		if shouldParallel(fullChunks) {
-			chunkCVsParallel(data[:fullChunks*ChunkLen], keyWords, flags, cvs[:fullChunks])
+		if shouldParallel(fullChunks, t) {
+			chunkCVsParallel(data[:fullChunks*ChunkLen], keyWords, flags, cvs[:fullChunks], t)
 		} else {
 			chunkCVs(data[:fullChunks*ChunkLen], keyWords, 0, flags, cvs[:fullChunks])
 		}
@@ -130,25 +129,27 @@ func reduceCVsToOutput(cvs [][8]uint32, keyWords [8]uint32, flags uint32) output
 	return parentOutput(level[0], level[1], keyWords, flags)
 }
 
-func shouldParallel(fullChunks int) bool {
-	if fullChunks < parallelMinChunks {
+func shouldParallel(fullChunks int, t Tuning) bool {
+	if fullChunks < t.ParallelMinChunks {
 		return false
 	}
 	return runtime.GOMAXPROCS(0) > 1
 }
 
-func chunkCVsParallel(data []byte, keyWords [8]uint32, flags uint32, out [][8]uint32) {
+func chunkCVsParallel(data []byte, keyWords [8]uint32, flags uint32, out [][8]uint32, t Tuning) {
 	chunks := len(out)
 	if chunks == 0 {
 		return
 	}
 	workers := runtime.GOMAXPROCS(0)
+	if t.MaxWorkers > 0 && workers > t.MaxWorkers {
+		workers = t.MaxWorkers
+	}
 	if workers > chunks {
 		workers = chunks
 	}
 	if haveAVX2 {
-		minPerWorker := 8
-		if maxWorkers := chunks / minPerWorker; workers > maxWorkers {
+		if maxWorkers := chunks / t.MinChunksPerWorker; workers > maxWorkers {
 			workers = maxWorkers
 		}
 	}
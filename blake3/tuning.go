@@ -0,0 +1,93 @@
+package blake3
+
+import (
+	"encoding/json"
+	"os"
+	"sync/atomic"
+)
+
+const (
+	defaultParallelMinChunks  = 128 // 128 KiB in 1 KiB chunks.
+	defaultMinChunksPerWorker = 8
+)
+
+// Tuning holds the input-size crossovers Sum256 and SumKeyed use to pick a
+// hashing strategy. The defaults were measured on a 4-core laptop; Calibrate
+// measures the current host instead.
+type Tuning struct {
+	// ParallelMinChunks is the smallest number of full 1 KiB chunks that is
+	// hashed with multiple goroutines.
+	ParallelMinChunks int `json:"parallel_min_chunks"`
+	// MinChunksPerWorker caps the goroutine count so that each one gets at
+	// least this many chunks when AVX2 is available.
+	MinChunksPerWorker int `json:"min_chunks_per_worker"`
+	// MaxWorkers caps the goroutines per call; 0 means GOMAXPROCS.
+	MaxWorkers int `json:"max_workers"`
+}
+
+var activeTuning atomic.Pointer[Tuning]
+
+// DefaultTuning returns the built-in crossovers.
+func DefaultTuning() Tuning {
+	return Tuning{
+		ParallelMinChunks:  defaultParallelMinChunks,
+		MinChunksPerWorker: defaultMinChunksPerWorker,
+	}
+}
+
+// CurrentTuning returns the crossovers currently in use.
+func CurrentTuning() Tuning {
+	if t := activeTuning.Load(); t != nil {
+		return *t
+	}
+	return DefaultTuning()
+}
+
+// SetTuning replaces the crossovers used by subsequent calls. Fields that are
+// out of range fall back to their defaults.
+func SetTuning(t Tuning) {
+	t = t.normalize()
+	activeTuning.Store(&t)
+}
+
+// Calibrate benchmarks serial and parallel chunk hashing on this host and
+// returns the measured crossovers without applying them; pass the result to
+// SetTuning or SaveTuning. It takes a few tens of milliseconds.
+func Calibrate() Tuning {
+	return calibrate().normalize()
+}
+
+// LoadTuning reads crossovers previously written by SaveTuning.
+func LoadTuning(path string) (Tuning, error) {
+	raw, err := os.ReadFile(path)
+	if err != nil {
+		return Tuning{}, err
+	}
+	var t Tuning
+	if err := json.Unmarshal(raw, &t); err != nil {
+		return Tuning{}, err
+	}
+	return t.normalize(), nil
+}
+
+// SaveTuning writes t as a JSON profile that LoadTuning can read back.
+func SaveTuning(path string, t Tuning) error {
+	raw, err := json.MarshalIndent(t.normalize(), "", "  ")
+	if err != nil {
+		return err
+	}
+	return os.WriteFile(path, append(raw, '\n'), 0o644)
+}
+
+func (t Tuning) normalize() Tuning {
+	if t.ParallelMinChunks < 1 {
+		t.ParallelMinChunks = defaultParallelMinChunks
+	}
+	if t.MinChunksPerWorker < 1 {
+		t.MinChunksPerWorker = defaultMinChunksPerWorker
+	}
+	if t.MaxWorkers < 0 {
+		t.MaxWorkers = 0
+	}
+	return t
+}
@@ -0,0 +1,90 @@
+//go:build amd64 && !purego
+
+package blake3
+
+import (
+	"math"
+	"runtime"
+	"time"
+)
+
+const (
+	calibrateMaxChunks = 2048 // 2 MiB in 1 KiB chunks.
+	calibrateTrials    = 5
+)
+
+func calibrate() Tuning {
+	t := DefaultTuning()
+	procs := runtime.GOMAXPROCS(0)
+	if procs < 2 || (!haveAVX2 && !haveSSE41) {
+		return t
+	}
+
+	data := make([]byte, calibrateMaxChunks*ChunkLen)
+	for i := range data {
+		data[i] = byte(i % 251)
+	}
+	out := make([][8]uint32, calibrateMaxChunks)
+	serial := func(chunks int) time.Duration {
+		return bestOf(func() {
+			chunkCVs(data[:chunks*ChunkLen], iv, 0, 0, out[:chunks])
+		})
+	}
+	parallel := func(chunks int, tt Tuning) time.Duration {
+		return bestOf(func() {
+			chunkCVsParallel(data[:chunks*ChunkLen], iv, 0, out[:chunks], tt)
+		})
+	}
+
+	bestWorkers, bestTime := procs, time.Duration(math.MaxInt64)
+	for workers := 2; ; workers *= 2 {
+		if workers > procs {
+			workers = procs
+		}
+		tt := t
+		tt.MaxWorkers = workers
+		if d := parallel(calibrateMaxChunks, tt); d < bestTime {
+			bestWorkers, bestTime = workers, d
+		}
+		if workers == procs {
+			break
+		}
+	}
+	if bestWorkers < procs {
+		t.MaxWorkers = bestWorkers
+	}
+
+	perWorkerChunks := 32 * procs
+	if perWorkerChunks > calibrateMaxChunks {
+		perWorkerChunks = calibrateMaxChunks
+	}
+	bestTime = time.Duration(math.MaxInt64)
+	for _, per := range []int{4, 8, 16, 32, 64} {
+		tt := t
+		tt.MinChunksPerWorker = per
+		if d := parallel(perWorkerChunks, tt); d < bestTime {
+			t.MinChunksPerWorker, bestTime = per, d
+		}
+	}
+
+	t.ParallelMinChunks = math.MaxInt32
+	for chunks := 16; chunks <= calibrateMaxChunks; chunks *= 2 {
+		if parallel(chunks, t) < serial(chunks)*9/10 {
+			t.ParallelMinChunks = chunks
+			break
+		}
+	}
+	return t
+}
+
+func bestOf(fn func()) time.Duration {
+	best := time.Duration(math.MaxInt64)
+	for i := 0; i < calibrateTrials; i++ {
+		start := time.Now()
+		fn()
+		if d := time.Since(start); d < best {
+			best = d
+		}
+	}
+	return best
+}
@@ -0,0 +1,7 @@
+//go:build !amd64 || purego
+
+package blake3
+
+func calibrate() Tuning {
+	return CurrentTuning()
+}
@@ -1,4 +1,7 @@
+#include "fp_blake3_cdc.h"
 #include "fp_blake3_fast.h"
+#include "fp_blake3_file.h"
+#include "fp_blake3_parallel.h"
 
 #include <stdint.h>
 #include <stdio.h>
@@ -71,6 +74,521 @@ static void self_test(void) {
     }
 }
 
+// Three chunks: one parent below the root, and the root parent itself
+// counted as an output compression.
+static void self_test_stats(void) {
+    static uint8_t input[3 * FP_BLAKE3_CHUNK_LEN];
+    uint8_t out[FP_BLAKE3_OUT_LEN];
+    FpBlake3Stats stats;
+
+    if (!fp_blake3_stats_enabled()) {
+        return;
+    }
+    fill_pattern(input, sizeof(input));
+    fp_blake3_stats_reset();
+    fp_blake3_hash(input, sizeof(input), out);
+    fp_blake3_stats_snapshot(&stats);
+    if (stats.parent_compressions != 1 || stats.xof_compressions != 1) {
+        fprintf(stderr, "self-test failed for stats: parents=%llu xof=%llu\n",
+                (unsigned long long)stats.parent_compressions,
+                (unsigned long long)stats.xof_compressions);
+        exit(1);
+    }
+    fp_blake3_stats_reset();
+}
+
+// Covers key material that ends in a full block and in a padded tail.
+static void self_test_derive_keys(void) {
+    static const char context[] = "fp_bench derive_keys self-test";
+    static const size_t km_lens[] = {1, 32, 64, 100, 128};
+    uint8_t key_material[8][2 * FP_BLAKE3_BLOCK_LEN];
+    const uint8_t *inputs[8];
+    size_t lens[8];
+    uint8_t batch[8 * FP_BLAKE3_OUT_LEN];
+    uint8_t single[FP_BLAKE3_OUT_LEN];
+    FpBlake3DeriveKeyContext ctx;
+
+    fp_blake3_derive_key_context_init(&ctx, context, sizeof(context) - 1);
+    for (size_t l = 0; l < sizeof(km_lens) / sizeof(km_lens[0]); l++) {
+        for (size_t i = 0; i < 8; i++) {
+            fill_pattern(key_material[i], sizeof(key_material[i]));
+            key_material[i][0] = (uint8_t)i;
+            inputs[i] = key_material[i];
+            lens[i] = km_lens[l];
+        }
+        fp_blake3_derive_keys(&ctx, inputs, lens, 8, batch);
+        for (size_t i = 0; i < 8; i++) {
+            fp_blake3_derive_key(context, sizeof(context) - 1,
+                                 inputs[i], lens[i], single);
+            if (memcmp(single, batch + i * FP_BLAKE3_OUT_LEN,
+                       sizeof(single)) != 0) {
+                fprintf(stderr,
+                        "self-test failed for derive_keys lane %zu, "
+                        "%zu bytes\n", i, lens[i]);
+                exit(1);
+            }
+        }
+    }
+}
+
+static void self_test_stream_set(void) {
+    enum { STREAMS = 8, LEN = 4096 + 100, STEP = 100 };
+    static uint8_t input[LEN];
+    FpBlake3StreamSet set;
+    FpBlake3Stream streams[STREAMS];
+    FpBlake3StreamWrite writes[STREAMS];
+    uint8_t expected[FP_BLAKE3_OUT_LEN];
+    uint8_t out[FP_BLAKE3_OUT_LEN];
+
+    fill_pattern(input, sizeof(input));
+    fp_blake3_hash(input, sizeof(input), expected);
+    fp_blake3_stream_set_init(&set);
+    for (size_t i = 0; i < STREAMS; i++) {
+        fp_blake3_stream_init(&set, &streams[i]);
+    }
+    for (size_t off = 0; off < LEN; off += STEP) {
+        size_t len = LEN - off < STEP ? LEN - off : STEP;
+        for (size_t i = 0; i < STREAMS; i++) {
+            writes[i].stream = &streams[i];
+            writes[i].input = input + off;
+            writes[i].len = len;
+        }
+        if (fp_blake3_stream_set_update(&set, writes, STREAMS) != 0) {
+            fprintf(stderr, "self-test failed: stream set alloc\n");
+            exit(1);
+        }
+    }
+    for (size_t i = 0; i < STREAMS; i++) {
+        fp_blake3_stream_finalize(&set, &streams[i], out, sizeof(out));
+        fp_blake3_stream_release(&streams[i]);
+        if (memcmp(out, expected, sizeof(out)) != 0) {
+            fprintf(stderr, "self-test failed for stream %zu\n", i);
+            exit(1);
+        }
+    }
+}
+
+// Streams of different lengths join at different rounds and write in
+// different sizes, so partial-chunk streams share rounds with bulk ones
+// and spills grow in the middle of an update.
+static void self_test_stream_set_mixed(void) {
+    enum { STREAMS = 11, LEN = 200 * 1024 };
+    static const size_t lens[STREAMS] = {
+        0, 1, 64, 1000, 1024, 1025, 7 * 1024 + 3, 33 * 1024,
+        130 * 1024 + 7, 150 * 1024, LEN,
+    };
+    static const size_t steps[STREAMS] = {
+        7, 1, 64, 100, 1500, 63, 4096, 1024, 9000, 33000, 777,
+    };
+    static uint8_t input[LEN];
+    uint8_t key[FP_BLAKE3_KEY_LEN];
+    FpBlake3StreamSet set;
+    FpBlake3Stream streams[STREAMS];
+    FpBlake3StreamWrite writes[STREAMS];
+    size_t offsets[STREAMS];
+    uint8_t expected[FP_BLAKE3_OUT_LEN];
+    uint8_t out[FP_BLAKE3_OUT_LEN];
+
+    fill_pattern(input, sizeof(input));
+    fill_pattern(key, sizeof(key));
+    for (int keyed = 0; keyed < 2; keyed++) {
+        if (keyed) {
+            fp_blake3_stream_set_init_keyed(&set, key);
+        } else {
+            fp_blake3_stream_set_init(&set);
+        }
+        for (size_t i = 0; i < STREAMS; i++) {
+            fp_blake3_stream_init(&set, &streams[i]);
+            offsets[i] = 0;
+        }
+        // Stream i joins at round i and then writes steps[i] per round.
+        for (size_t round = 0;; round++) {
+            size_t count = 0;
+            for (size_t i = 0; i < STREAMS && i <= round; i++) {
+                size_t left = lens[i] - offsets[i];
+                size_t len = left < steps[i] ? left : steps[i];
+                if (len == 0) {
+                    continue;
+                }
+                writes[count].stream = &streams[i];
+                writes[count].input = input + offsets[i];
+                writes[count].len = len;
+                offsets[i] += len;
+                count++;
+            }
+            if (count == 0 && round >= STREAMS) {
+                break;
+            }
+            if (fp_blake3_stream_set_update(&set, writes, count) != 0) {
+                fprintf(stderr, "self-test failed: stream set alloc\n");
+                exit(1);
+            }
+        }
+        for (size_t i = 0; i < STREAMS; i++) {
+            if (keyed) {
+                fp_blake3_hash_keyed(key, input, lens[i], expected);
+            } else {
+                fp_blake3_hash(input, lens[i], expected);
+            }
+            fp_blake3_stream_finalize(&set, &streams[i], out, sizeof(out));
+            fp_blake3_stream_release(&streams[i]);
+            if (memcmp(out, expected, sizeof(out)) != 0) {
+                fprintf(stderr,
+                        "self-test failed for mixed stream %zu (keyed=%d)\n",
+                        i, keyed);
+                exit(1);
+            }
+        }
+    }
+}
+
+// The spill block should track the depth of the CV stack, which is about
+// log2 of the chunk count, rather than its worst case.
+static void self_test_stream_spill(void) {
+    static const size_t chunk_counts[] = {3, 1023, 4097};
+    FpBlake3StreamSet set;
+    FpBlake3Stream stream;
+    uint8_t expected[FP_BLAKE3_OUT_LEN];
+    uint8_t out[FP_BLAKE3_OUT_LEN];
+
+    fp_blake3_stream_set_init(&set);
+    for (size_t c = 0; c < sizeof(chunk_counts) / sizeof(chunk_counts[0]);
+         c++) {
+        size_t chunks = chunk_counts[c];
+        size_t len = chunks * FP_BLAKE3_CHUNK_LEN + 1;
+        size_t bits = 0;
+        uint8_t *input = (uint8_t *)malloc(len);
+        if (!input) {
+            fprintf(stderr, "self-test failed: stream spill input\n");
+            exit(1);
+        }
+        fill_pattern(input, len);
+        fp_blake3_hash(input, len, expected);
+        fp_blake3_stream_init(&set, &stream);
+        for (size_t off = 0; off < len; off += 9000) {
+            size_t step = len - off < 9000 ? len - off : 9000;
+            if (fp_blake3_stream_update(&set, &stream, input + off, step) !=
+                0) {
+                fprintf(stderr, "self-test failed: stream spill alloc\n");
+                exit(1);
+            }
+        }
+        fp_blake3_stream_finalize(&set, &stream, out, sizeof(out));
+        for (size_t n = chunks; n != 0; n >>= 1) {
+            bits++;
+        }
+        if (memcmp(out, expected, sizeof(out)) != 0 ||
+            (chunks < 4 && stream.cv_spill != NULL) ||
+            stream.cv_spill_cap > 2 * bits) {
+            fprintf(stderr,
+                    "self-test failed for stream spill, %zu chunks "
+                    "(%u CVs)\n", chunks, (unsigned)stream.cv_spill_cap);
+            exit(1);
+        }
+        fp_blake3_stream_release(&stream);
+        free(input);
+    }
+}
+
+static void merkle_pair(const uint8_t *key, const uint8_t *pair,
+                        uint8_t *out) {
+    if (key) {
+        fp_blake3_hash_keyed(key, pair, 2 * FP_BLAKE3_OUT_LEN, out);
+    } else {
+        fp_blake3_hash(pair, 2 * FP_BLAKE3_OUT_LEN, out);
+    }
+}
+
+static void self_test_merkle(void) {
+    enum { NODES = 11 };
+    uint8_t key[FP_BLAKE3_KEY_LEN];
+    uint8_t nodes[NODES * FP_BLAKE3_OUT_LEN];
+    uint8_t level[NODES * FP_BLAKE3_OUT_LEN];
+    uint8_t expected[FP_BLAKE3_OUT_LEN];
+    uint8_t root[FP_BLAKE3_OUT_LEN];
+
+    fill_pattern(key, sizeof(key));
+    for (int keyed = 0; keyed < 2; keyed++) {
+        const uint8_t *k = keyed ? key : NULL;
+        size_t count = NODES;
+        fill_pattern(nodes, sizeof(nodes));
+        memcpy(level, nodes, sizeof(nodes));
+        while (count > 1) {
+            size_t parents = count / 2;
+            for (size_t i = 0; i < parents; i++) {
+                merkle_pair(k, level + i * 2 * FP_BLAKE3_OUT_LEN, root);
+                memcpy(level + i * FP_BLAKE3_OUT_LEN, root, sizeof(root));
+            }
+            if (count & 1) {
+                memmove(level + parents * FP_BLAKE3_OUT_LEN,
+                        level + (count - 1) * FP_BLAKE3_OUT_LEN,
+                        FP_BLAKE3_OUT_LEN);
+            }
+            count = (count + 1) / 2;
+        }
+        memcpy(expected, level, sizeof(expected));
+        fp_blake3_merkle_root(k, nodes, NODES, root);
+        if (memcmp(root, expected, sizeof(root)) != 0) {
+            fprintf(stderr, "self-test failed for merkle root (keyed=%d)\n",
+                    keyed);
+            exit(1);
+        }
+    }
+}
+
+typedef struct {
+    const uint8_t *input;
+    uint64_t next_offset;
+    int failed;
+} cdc_check;
+
+static void check_cdc_chunks(void *user,
+                             const FpBlake3CdcChunk *chunks,
+                             size_t count) {
+    cdc_check *check = (cdc_check *)user;
+    uint8_t expected[FP_BLAKE3_OUT_LEN];
+    for (size_t i = 0; i < count; i++) {
+        fp_blake3_hash(check->input + chunks[i].offset, chunks[i].length,
+                       expected);
+        if (chunks[i].offset != check->next_offset ||
+            chunks[i].length > FP_BLAKE3_CDC_MAX_SIZE ||
+            memcmp(expected, chunks[i].digest, sizeof(expected)) != 0) {
+            check->failed = 1;
+        }
+        check->next_offset += chunks[i].length;
+    }
+}
+
+static void self_test_cdc(void) {
+    enum { LEN = 1 << 20, STEP = 1000 };
+    static uint8_t input[LEN];
+    static uint8_t carry[FP_BLAKE3_CDC_MAX_SIZE];
+    static FpBlake3Cdc cdc;
+    cdc_check check = {input, 0, 0};
+    uint32_t state = 1;
+
+    for (size_t i = 0; i < LEN; i++) {
+        state = state * 1664525u + 1013904223u;
+        input[i] = (uint8_t)(state >> 24);
+    }
+    fp_blake3_cdc_init(&cdc, NULL, FP_BLAKE3_CDC_MIN_SIZE,
+                       FP_BLAKE3_CDC_AVG_SIZE, FP_BLAKE3_CDC_MAX_SIZE,
+                       carry, sizeof(carry), check_cdc_chunks, &check);
+    for (size_t off = 0; off < LEN; off += STEP) {
+        size_t len = LEN - off < STEP ? LEN - off : STEP;
+        if (fp_blake3_cdc_update(&cdc, input + off, len) != 0) {
+            check.failed = 1;
+        }
+    }
+    if (fp_blake3_cdc_finish(&cdc) != 0 || check.next_offset != LEN) {
+        check.failed = 1;
+    }
+    fp_blake3_cdc_release(&cdc);
+    if (check.failed) {
+        fprintf(stderr, "self-test failed for content-defined chunks\n");
+        exit(1);
+    }
+}
+
+// Keyed levels split across the workers must match the serial builder.
+static void self_test_pool_merkle(FpBlake3Pool *pool) {
+    enum { NODES = 1001 };
+    static uint8_t nodes[NODES * FP_BLAKE3_OUT_LEN];
+    static uint8_t serial[NODES * FP_BLAKE3_OUT_LEN];
+    static uint8_t level[NODES * FP_BLAKE3_OUT_LEN];
+    uint8_t key[FP_BLAKE3_KEY_LEN];
+    uint8_t expected[FP_BLAKE3_OUT_LEN];
+    uint8_t root[FP_BLAKE3_OUT_LEN];
+
+    fill_pattern(key, sizeof(key));
+    fill_pattern(nodes, sizeof(nodes));
+    size_t n = fp_blake3_merkle_level(key, nodes, NODES, serial);
+    if (fp_blake3_pool_merkle_level(pool, key, nodes, NODES, level) != n ||
+        memcmp(level, serial, n * FP_BLAKE3_OUT_LEN) != 0) {
+        fprintf(stderr, "self-test failed for parallel merkle level\n");
+        exit(1);
+    }
+    memcpy(serial, nodes, sizeof(nodes));
+    fp_blake3_merkle_root(key, serial, NODES, expected);
+    if (fp_blake3_pool_merkle_root(pool, key, nodes, NODES, root) != 0 ||
+        memcmp(root, expected, sizeof(root)) != 0) {
+        fprintf(stderr, "self-test failed for parallel merkle root\n");
+        exit(1);
+    }
+}
+
+static void self_test_pool(void) {
+    enum { LEN = 300 * 1024 + 7 };
+    static uint8_t input[LEN];
+    uint8_t expected[FP_BLAKE3_OUT_LEN];
+    uint8_t out[FP_BLAKE3_OUT_LEN];
+    FpBlake3PoolConfig cfg;
+
+    fill_pattern(input, sizeof(input));
+    fp_blake3_hash(input, sizeof(input), expected);
+    fp_blake3_pool_defaults(&cfg);
+    cfg.threads = 3;
+    cfg.min_subtree_chunks = 16;
+    cfg.min_parallel_bytes = 0;
+    FpBlake3Pool *pool = fp_blake3_pool_create(&cfg);
+    if (!pool || fp_blake3_pool_hash(pool, NULL, input, sizeof(input),
+                                     out, sizeof(out)) != 0 ||
+        memcmp(out, expected, sizeof(out)) != 0) {
+        fprintf(stderr, "self-test failed for parallel pool\n");
+        exit(1);
+    }
+    self_test_pool_merkle(pool);
+    fp_blake3_pool_destroy(pool);
+}
+
+// Large enough for 64 MiB subtrees on two workers, so each worker runs a
+// long chunk loop on its own pthread stack.
+static void self_test_pool_large(void) {
+    const size_t len = (512u << 20) + 5;
+    uint8_t expected[FP_BLAKE3_OUT_LEN];
+    uint8_t out[FP_BLAKE3_OUT_LEN];
+    FpBlake3PoolConfig cfg;
+
+    uint8_t *input = (uint8_t *)malloc(len);
+    if (!input) {
+        fprintf(stderr, "self-test skipped large pool input\n");
+        return;
+    }
+    fill_pattern(input, len);
+    fp_blake3_hash(input, len, expected);
+    fp_blake3_pool_defaults(&cfg);
+    cfg.threads = 2;
+    FpBlake3Pool *pool = fp_blake3_pool_create(&cfg);
+    if (!pool || fp_blake3_pool_hash(pool, NULL, input, len,
+                                     out, sizeof(out)) != 0 ||
+        memcmp(out, expected, sizeof(out)) != 0) {
+        fprintf(stderr, "self-test failed for large parallel pool\n");
+        exit(1);
+    }
+    fp_blake3_pool_destroy(pool);
+    free(input);
+}
+
+// Hashes path through both engines and checks the digest and that the
+// requested engine is the one that ran. io_uring may be unavailable (old
+// kernels, seccomp), in which case the call falls back to reader threads.
+static void check_file_engines(const char *path,
+                               const uint8_t *expected,
+                               uint32_t read_bytes,
+                               uint32_t queue_depth) {
+    uint8_t out[FP_BLAKE3_OUT_LEN];
+    FpBlake3FileConfig cfg;
+
+    fp_blake3_file_defaults(&cfg);
+    cfg.read_bytes = read_bytes;
+    cfg.queue_depth = queue_depth;
+    for (int io_uring = 0; io_uring < 2; io_uring++) {
+        cfg.io_uring = io_uring;
+        int engine = fp_blake3_file_hash(&cfg, NULL, NULL, path, out,
+                                         sizeof(out));
+        if (engine < 0 || memcmp(out, expected, sizeof(out)) != 0 ||
+            (!io_uring && engine != FP_BLAKE3_FILE_THREADS)) {
+            fprintf(stderr, "self-test failed for file engine %d, "
+                    "%u-byte reads\n", io_uring, (unsigned)read_bytes);
+            remove(path);
+            exit(1);
+        }
+#ifdef __linux__
+        if (io_uring && engine != FP_BLAKE3_FILE_IO_URING) {
+            fprintf(stderr, "note: io_uring unavailable, file self-test "
+                    "used reader threads\n");
+        }
+#endif
+    }
+}
+
+static void write_file(const char *path, const uint8_t *input, size_t len) {
+    FILE *f = fopen(path, "wb");
+    if (!f || fwrite(input, 1, len, f) != len) {
+        fprintf(stderr, "self-test failed: can't write %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+}
+
+static void self_test_file(void) {
+    enum { LEN = 5 * FP_BLAKE3_FILE_MIN_READ + 123 };
+    static const char path[] = "fp_bench_selftest.tmp";
+    static uint8_t input[LEN];
+    const size_t large_len = 2 * (size_t)FP_BLAKE3_FILE_MAX_READ + 123;
+    uint8_t expected[FP_BLAKE3_OUT_LEN];
+
+    fill_pattern(input, sizeof(input));
+    fp_blake3_hash(input, sizeof(input), expected);
+    write_file(path, input, sizeof(input));
+    check_file_engines(path, expected, FP_BLAKE3_FILE_MIN_READ, 4);
+
+    // Full buffers at the largest read size are hashed as 64 MiB subtrees
+    // on the calling thread.
+    uint8_t *large = (uint8_t *)malloc(large_len);
+    if (!large) {
+        fprintf(stderr, "self-test skipped large file input\n");
+        remove(path);
+        return;
+    }
+    fill_pattern(large, large_len);
+    fp_blake3_hash(large, large_len, expected);
+    write_file(path, large, large_len);
+    free(large);
+    check_file_engines(path, expected, FP_BLAKE3_FILE_MAX_READ, 2);
+    remove(path);
+}
+
+// Cross-checks the NASM kernels against the portable ones. Builds without
+// NASM only have the latter and skip this.
+static void self_test_kernels(void) {
+    static const size_t lens[] = {64, 1024, 3 * 1024 + 5, 9 * 1024, 33 * 1024};
+    static uint8_t input[33 * 1024];
+    uint8_t expected[FP_BLAKE3_OUT_LEN];
+    uint8_t out[FP_BLAKE3_OUT_LEN];
+
+    if (fp_blake3_kernels_set(FP_BLAKE3_KERNELS_ASM) != 0) {
+        return;
+    }
+    fill_pattern(input, sizeof(input));
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        fp_blake3_kernels_set(FP_BLAKE3_KERNELS_ASM);
+        fp_blake3_hash(input, lens[i], expected);
+        fp_blake3_kernels_set(FP_BLAKE3_KERNELS_C);
+        fp_blake3_hash(input, lens[i], out);
+        if (memcmp(out, expected, sizeof(out)) != 0) {
+            fprintf(stderr, "self-test failed: kernel sets differ at %zu\n",
+                    lens[i]);
+            exit(1);
+        }
+    }
+    fp_blake3_kernels_set(FP_BLAKE3_KERNELS_ASM);
+}
+
+static void print_kernel_stats(const char *name,
+                               const FpBlake3KernelStats *k) {
+    double cpb = k->bytes ? (double)k->cycles / (double)k->bytes : 0.0;
+    printf("  %-8s calls=%llu bytes=%llu cycles/byte=%.2f\n",
+           name,
+           (unsigned long long)k->calls,
+           (unsigned long long)k->bytes,
+           cpb);
+}
+
+static void print_stats(size_t n) {
+    FpBlake3Stats stats;
+    fp_blake3_stats_snapshot(&stats);
+    printf("fp_c stats n=%zu\n", n);
+    print_kernel_stats("scalar", &stats.scalar);
+    print_kernel_stats("simd4", &stats.simd4);
+    print_kernel_stats("simd8", &stats.simd8);
+    print_kernel_stats("partial", &stats.partial);
+    printf("  parents=%llu xof_blocks=%llu xof_bytes=%llu\n",
+           (unsigned long long)stats.parent_compressions,
+           (unsigned long long)stats.xof_compressions,
+           (unsigned long long)stats.xof_bytes);
+}
+
 static void bench_size(size_t n, double target_seconds) {
     uint8_t *buf = (uint8_t *)malloc(n);
     if (!buf) {
@@ -81,6 +599,7 @@ static void bench_size(size_t n, double target_seconds) {
 
     uint8_t out[FP_BLAKE3_OUT_LEN];
     uint64_t iters = 0;
+    fp_blake3_stats_reset();
     double start = now_seconds();
     double elapsed = 0.0;
     while (elapsed < target_seconds) {
@@ -98,11 +617,25 @@ static void bench_size(size_t n, double target_seconds) {
 
     printf("fp_c size=%zu bytes  iters=%llu  ns/op=%.0f  MB/s=%.2f\n",
            n, (unsigned long long)iters, ns_per_op, mbps);
+    if (fp_blake3_stats_enabled()) {
+        print_stats(n);
+    }
     free(buf);
 }
 
 int main(void) {
     self_test();
+    self_test_stats();
+    self_test_derive_keys();
+    self_test_stream_set();
+    self_test_stream_set_mixed();
+    self_test_stream_spill();
+    self_test_merkle();
+    self_test_cdc();
+    self_test_pool();
+    self_test_pool_large();
+    self_test_kernels();
+    self_test_file();
     const double target_seconds = 1.0;
     bench_size(1024, target_seconds);
     bench_size(8 * 1024, target_seconds);
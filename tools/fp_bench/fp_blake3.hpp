@@ -0,0 +1,353 @@
+#pragma once
+
+// Header-only C++20 layer over fp_blake3_fast.h. Hasher<Mode> sets up its
+// key words and flags inline, so for a given mode they are compile-time
+// constants; hashing itself goes through the C library.
+
+#include "fp_blake3_fast.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace fp_blake3 {
+
+inline constexpr std::size_t out_len = FP_BLAKE3_OUT_LEN;
+inline constexpr std::size_t key_len = FP_BLAKE3_KEY_LEN;
+inline constexpr std::size_t block_len = FP_BLAKE3_BLOCK_LEN;
+inline constexpr std::size_t chunk_len = FP_BLAKE3_CHUNK_LEN;
+
+inline constexpr std::array<std::uint32_t, 8> iv = {
+    0x6a09e667u, 0xbb67ae85u, 0x3c6ef372u, 0xa54ff53au,
+    0x510e527fu, 0x9b05688cu, 0x1f83d9abu, 0x5be0cd19u,
+};
+
+namespace flags {
+inline constexpr std::uint32_t chunk_start = 1u << 0;
+inline constexpr std::uint32_t chunk_end = 1u << 1;
+inline constexpr std::uint32_t parent = 1u << 2;
+inline constexpr std::uint32_t root = 1u << 3;
+inline constexpr std::uint32_t keyed_hash = 1u << 4;
+inline constexpr std::uint32_t derive_key_context = 1u << 5;
+inline constexpr std::uint32_t derive_key_material = 1u << 6;
+}  // namespace flags
+
+enum class Mode : std::uint32_t {
+    hash = 0,
+    keyed = flags::keyed_hash,
+    derive_key = flags::derive_key_material,
+};
+
+using Digest = std::array<std::byte, out_len>;
+static_assert(sizeof(Digest) == out_len);
+using KeyView = std::span<const std::byte, key_len>;
+
+namespace detail {
+
+template <class T>
+inline constexpr bool is_char_array_v = false;
+
+template <class C, std::size_t N>
+inline constexpr bool is_char_array_v<C[N]> =
+    std::is_same_v<C, char> || std::is_same_v<C, char8_t> ||
+    std::is_same_v<C, char16_t> || std::is_same_v<C, char32_t> ||
+    std::is_same_v<C, wchar_t>;
+
+}  // namespace detail
+
+// Contiguous ranges of trivially copyable elements, hashed as their bytes.
+// Character arrays are left out since a string literal would hash its
+// terminating NUL; literals go through the std::string_view overloads.
+template <class R>
+concept ByteRange =
+    std::ranges::contiguous_range<R> && std::ranges::sized_range<R> &&
+    std::is_trivially_copyable_v<std::ranges::range_value_t<R>> &&
+    !detail::is_char_array_v<std::remove_cv_t<std::remove_reference_t<R>>>;
+
+template <ByteRange R>
+std::span<const std::byte> as_byte_span(const R &r) noexcept {
+    return std::as_bytes(std::span(std::ranges::data(r), std::ranges::size(r)));
+}
+
+namespace detail {
+
+inline const std::uint8_t *u8(const std::byte *p) noexcept {
+    return reinterpret_cast<const std::uint8_t *>(p);
+}
+
+inline std::uint8_t *u8(std::byte *p) noexcept {
+    return reinterpret_cast<std::uint8_t *>(p);
+}
+
+constexpr std::array<std::uint32_t, 8> key_words(KeyView key) noexcept {
+    std::array<std::uint32_t, 8> words{};
+    for (std::size_t i = 0; i < words.size(); i++) {
+        words[i] = static_cast<std::uint32_t>(key[4 * i]) |
+                   static_cast<std::uint32_t>(key[4 * i + 1]) << 8 |
+                   static_cast<std::uint32_t>(key[4 * i + 2]) << 16 |
+                   static_cast<std::uint32_t>(key[4 * i + 3]) << 24;
+    }
+    return words;
+}
+
+// Mirrors fp_blake3_hasher_init*: only the chunk state and stack depth need
+// resetting.
+inline void init(FpBlake3Hasher &h,
+                 const std::array<std::uint32_t, 8> &words,
+                 std::uint32_t mode_flags) noexcept {
+    for (std::size_t i = 0; i < 8; i++) {
+        h.key_words[i] = words[i];
+        h.cv[i] = words[i];
+    }
+    h.chunk_counter = 0;
+    h.block_len = 0;
+    h.blocks_compressed = 0;
+    h.flags = mode_flags;
+    h.cv_stack_len = 0;
+}
+
+}  // namespace detail
+
+class DeriveKeyContext {
+public:
+    explicit DeriveKeyContext(std::string_view context) noexcept {
+        fp_blake3_derive_key_context_init(&ctx_, context.data(),
+                                          context.size());
+    }
+
+    const FpBlake3DeriveKeyContext &native() const noexcept { return ctx_; }
+
+private:
+    FpBlake3DeriveKeyContext ctx_;
+};
+
+template <Mode M>
+class Hasher {
+public:
+    Hasher() noexcept
+        requires(M == Mode::hash)
+    {
+        detail::init(state_, iv, 0);
+    }
+
+    explicit Hasher(KeyView key) noexcept
+        requires(M == Mode::keyed)
+        : key_(detail::key_words(key)) {
+        detail::init(state_, key_, flags::keyed_hash);
+    }
+
+    explicit Hasher(const DeriveKeyContext &ctx) noexcept
+        requires(M == Mode::derive_key)
+    {
+        for (std::size_t i = 0; i < 8; i++) {
+            key_[i] = ctx.native().key_words[i];
+        }
+        detail::init(state_, key_, flags::derive_key_material);
+    }
+
+    Hasher(Hasher &&) noexcept = default;
+    Hasher &operator=(Hasher &&) noexcept = default;
+    Hasher(const Hasher &) = delete;
+    Hasher &operator=(const Hasher &) = delete;
+
+    Hasher &update(std::span<const std::byte> input) noexcept {
+        fp_blake3_hasher_update(&state_, detail::u8(input.data()),
+                                input.size());
+        return *this;
+    }
+
+    template <ByteRange R>
+    Hasher &update(const R &input) noexcept {
+        return update(as_byte_span(input));
+    }
+
+    Hasher &update(std::string_view input) noexcept {
+        return update(as_byte_span(input));
+    }
+
+    Digest finalize() const noexcept {
+        Digest out;
+        fp_blake3_hasher_finalize(&state_, detail::u8(out.data()));
+        return out;
+    }
+
+    void finalize_xof(std::span<std::byte> out) const noexcept {
+        fp_blake3_hasher_finalize_xof(&state_, detail::u8(out.data()),
+                                      out.size());
+    }
+
+    void reset() noexcept {
+        if constexpr (M == Mode::hash) {
+            detail::init(state_, iv, 0);
+        } else {
+            detail::init(state_, key_, static_cast<std::uint32_t>(M));
+        }
+    }
+
+    FpBlake3Hasher &native() noexcept { return state_; }
+
+private:
+    struct NoKey {};
+    [[no_unique_address]] std::conditional_t<M == Mode::hash,
+                                             NoKey,
+                                             std::array<std::uint32_t, 8>>
+        key_{};
+    FpBlake3Hasher state_;
+};
+
+inline Digest hash(std::span<const std::byte> input) noexcept {
+    Digest out;
+    fp_blake3_hash(detail::u8(input.data()), input.size(),
+                   detail::u8(out.data()));
+    return out;
+}
+
+template <ByteRange R>
+Digest hash(const R &input) noexcept {
+    return hash(as_byte_span(input));
+}
+
+inline Digest hash(std::string_view input) noexcept {
+    return hash(as_byte_span(input));
+}
+
+inline Digest keyed_hash(KeyView key,
+                         std::span<const std::byte> input) noexcept {
+    Digest out;
+    fp_blake3_hash_keyed(detail::u8(key.data()), detail::u8(input.data()),
+                         input.size(), detail::u8(out.data()));
+    return out;
+}
+
+template <ByteRange R>
+Digest keyed_hash(KeyView key, const R &input) noexcept {
+    return keyed_hash(key, as_byte_span(input));
+}
+
+inline Digest keyed_hash(KeyView key, std::string_view input) noexcept {
+    return keyed_hash(key, as_byte_span(input));
+}
+
+inline Digest derive_key(const DeriveKeyContext &ctx,
+                         std::span<const std::byte> key_material) noexcept {
+    Digest out;
+    fp_blake3_derive_key_ctx(&ctx.native(), detail::u8(key_material.data()),
+                             key_material.size(), detail::u8(out.data()));
+    return out;
+}
+
+template <ByteRange R>
+Digest derive_key(const DeriveKeyContext &ctx, const R &key_material) noexcept {
+    return derive_key(ctx, as_byte_span(key_material));
+}
+
+inline Digest derive_key(const DeriveKeyContext &ctx,
+                         std::string_view key_material) noexcept {
+    return derive_key(ctx, as_byte_span(key_material));
+}
+
+// Ranges whose elements are byte ranges, e.g. std::vector<std::span<...>>.
+template <class R>
+concept ByteRangeRange =
+    std::ranges::input_range<R> && ByteRange<std::ranges::range_reference_t<R>>;
+
+namespace detail {
+
+inline constexpr std::size_t batch_window = 16;
+
+// Hashes inputs as independent messages through the stream-set kernels,
+// batch_window at a time. Throws std::bad_alloc if a stream spill block
+// cannot be allocated.
+template <ByteRangeRange R>
+void stream_batch(const FpBlake3StreamSet &set,
+                  R &&inputs,
+                  std::span<Digest> out) {
+    std::array<FpBlake3Stream, batch_window> streams;
+    std::array<FpBlake3StreamWrite, batch_window> writes;
+    for (auto &stream : streams) {
+        fp_blake3_stream_init(&set, &stream);
+    }
+    auto release = [&] {
+        for (auto &stream : streams) {
+            fp_blake3_stream_release(&stream);
+        }
+    };
+    auto flush = [&](std::size_t n, std::size_t first) {
+        if (fp_blake3_stream_set_update(&set, writes.data(), n) != 0) {
+            release();
+            throw std::bad_alloc();
+        }
+        for (std::size_t i = 0; i < n; i++) {
+            fp_blake3_stream_finalize(&set, &streams[i],
+                                      u8(out[first + i].data()), out_len);
+            fp_blake3_stream_reset(&set, &streams[i]);
+        }
+    };
+    std::size_t n = 0;
+    std::size_t done = 0;
+    for (auto &&input : inputs) {
+        std::span<const std::byte> bytes = as_byte_span(input);
+        writes[n] = {&streams[n], u8(bytes.data()), bytes.size()};
+        if (++n == batch_window) {
+            flush(n, done);
+            done += n;
+            n = 0;
+        }
+    }
+    flush(n, done);
+    release();
+}
+
+}  // namespace detail
+
+// Batch overloads write one digest per input into out, which must have room
+// for all of them.
+template <ByteRangeRange R>
+void hash_batch(R &&inputs, std::span<Digest> out) {
+    FpBlake3StreamSet set;
+    fp_blake3_stream_set_init(&set);
+    detail::stream_batch(set, std::forward<R>(inputs), out);
+}
+
+template <ByteRangeRange R>
+void keyed_hash_batch(KeyView key, R &&inputs, std::span<Digest> out) {
+    FpBlake3StreamSet set;
+    fp_blake3_stream_set_init_keyed(&set, detail::u8(key.data()));
+    detail::stream_batch(set, std::forward<R>(inputs), out);
+}
+
+template <ByteRangeRange R>
+void derive_keys(const DeriveKeyContext &ctx,
+                 R &&inputs,
+                 std::span<Digest> out) noexcept {
+    constexpr std::size_t window = FP_BLAKE3_MAX_BATCH_CHUNKS;
+    std::array<const std::uint8_t *, window> material;
+    std::array<std::size_t, window> lens;
+    std::size_t n = 0;
+    std::size_t done = 0;
+    auto flush = [&] {
+        fp_blake3_derive_keys(&ctx.native(), material.data(), lens.data(), n,
+                              detail::u8(out[done].data()));
+        done += n;
+        n = 0;
+    };
+    for (auto &&input : inputs) {
+        std::span<const std::byte> bytes = as_byte_span(input);
+        material[n] = detail::u8(bytes.data());
+        lens[n] = bytes.size();
+        if (++n == window) {
+            flush();
+        }
+    }
+    if (n != 0) {
+        flush();
+    }
+}
+
+}  // namespace fp_blake3
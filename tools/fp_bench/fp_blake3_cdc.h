@@ -0,0 +1,72 @@
+#pragma once
+
+#include "fp_blake3_fast.h"
+
+#define FP_BLAKE3_CDC_MIN_SIZE  (2 * 1024)
+#define FP_BLAKE3_CDC_AVG_SIZE  (8 * 1024)
+#define FP_BLAKE3_CDC_MAX_SIZE  (64 * 1024)
+#define FP_BLAKE3_CDC_SCAN_LEN  (2 * FP_BLAKE3_CDC_MAX_SIZE)
+#define FP_BLAKE3_CDC_BATCH     16
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint64_t offset;
+    size_t length;
+    uint8_t digest[FP_BLAKE3_OUT_LEN];
+} FpBlake3CdcChunk;
+
+// Receives up to FP_BLAKE3_CDC_BATCH records in stream order. The records
+// are only valid for the duration of the call.
+typedef void (*FpBlake3CdcEmit)(void *user,
+                                const FpBlake3CdcChunk *chunks,
+                                size_t count);
+
+// Content-defined chunker (FastCDC-style gear hash with normalized
+// chunking) that hashes every chunk with BLAKE3. Boundaries are found a
+// scan window at a time and the chunks of a window are hashed together
+// through the stream-set kernels while they are still in cache. Only the
+// tail of a write that does not yet end in a boundary is copied, into the
+// caller's carry buffer.
+typedef struct {
+    size_t min_size;
+    size_t avg_size;
+    size_t max_size;
+    uint64_t mask_s;
+    uint64_t mask_l;
+    FpBlake3CdcEmit emit;
+    void *user;
+    uint8_t *carry;
+    size_t carry_len;
+    uint64_t offset;
+    size_t pending;
+    FpBlake3StreamSet set;
+    FpBlake3StreamWrite writes[FP_BLAKE3_CDC_BATCH];
+    FpBlake3Stream streams[FP_BLAKE3_CDC_BATCH];
+    FpBlake3CdcChunk records[FP_BLAKE3_CDC_BATCH];
+    uint64_t bits[FP_BLAKE3_CDC_SCAN_LEN / 64];
+} FpBlake3Cdc;
+
+// key may be NULL for unkeyed digests. Sizes must satisfy
+// 64 <= min < avg < max <= FP_BLAKE3_CDC_MAX_SIZE and the carry buffer must
+// hold at least max_size bytes. Returns -1 on invalid parameters.
+int fp_blake3_cdc_init(FpBlake3Cdc *cdc,
+                       const uint8_t *key,
+                       size_t min_size,
+                       size_t avg_size,
+                       size_t max_size,
+                       uint8_t *carry,
+                       size_t carry_len,
+                       FpBlake3CdcEmit emit,
+                       void *user);
+// Both return -1 if a stream spill block could not be allocated.
+int fp_blake3_cdc_update(FpBlake3Cdc *cdc, const uint8_t *input, size_t len);
+// Emits the final chunk and rewinds the chunker for a new stream.
+int fp_blake3_cdc_finish(FpBlake3Cdc *cdc);
+void fp_blake3_cdc_release(FpBlake3Cdc *cdc);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,13 +1,34 @@
 #include "fp_blake3_fast.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // Derived from FP_ASM_LIB's fp_blake3.c, with full tree hashing and streaming.
 
 #ifdef __AVX2__
 #include <cpuid.h>
+#include <x86intrin.h>
 #endif
 
+#ifdef FP_BLAKE3_STATS
+#include <x86intrin.h>
+
+static _Thread_local FpBlake3Stats tls_stats;
+
+#define STATS_BEGIN() __rdtsc()
+#define STATS_KERNEL(path, nbytes, t0)                 \
+    (tls_stats.path.calls++,                           \
+     tls_stats.path.bytes += (uint64_t)(nbytes),       \
+     tls_stats.path.cycles += __rdtsc() - (t0))
+#define STATS_COUNT(field, n) (tls_stats.field += (uint64_t)(n))
+#else
+#define STATS_BEGIN() 0
+#define STATS_KERNEL(path, nbytes, t0) ((void)(nbytes), (void)(t0))
+#define STATS_COUNT(field, n) ((void)0)
+#endif
+
+#ifndef FP_BLAKE3_NO_ASM
 extern void fp_blake3_compress_words_asm(const uint32_t cv[8],
                                          const uint32_t block_words[16],
                                          uint64_t counter,
@@ -24,6 +45,7 @@ extern void fp_blake3_compress8_asm(uint32_t cv[8][8],
                                     const uint64_t counters[8],
                                     uint32_t flags);
 #endif
+#endif
 
 enum {
     CHUNK_START = 1 << 0,
@@ -88,14 +110,398 @@ static void copy_u32_rec(uint32_t *dst, const uint32_t *src, size_t count) {
     copy_u32_rec(dst + 1, src + 1, count - 1);
 }
 
+// Portable kernels: the same compression as the NASM objects in plain C, the
+// lane versions with AVX2/SSE intrinsics. They are always compiled so the
+// two can be cross-checked; -DFP_BLAKE3_NO_ASM makes them the only ones.
+static inline void g_c(uint32_t v[16],
+                       size_t a,
+                       size_t b,
+                       size_t c,
+                       size_t d,
+                       uint32_t x,
+                       uint32_t y) {
+    v[a] = v[a] + v[b] + x;
+    v[d] = rotr32(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = rotr32(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + y;
+    v[d] = rotr32(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];
+    v[b] = rotr32(v[b] ^ v[c], 7);
+}
+
+static inline void round_c(uint32_t v[16], const uint32_t m[16], size_t r) {
+    const uint8_t *s = MSG_SCHEDULE[r];
+    g_c(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    g_c(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    g_c(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    g_c(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    g_c(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    g_c(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    g_c(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    g_c(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+}
+
+static inline void compress_c(const uint32_t cv[8],
+                              const uint32_t block_words[16],
+                              uint64_t counter,
+                              uint32_t block_len,
+                              uint32_t flags,
+                              uint32_t out[16]) {
+    uint32_t v[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        IV[0], IV[1], IV[2], IV[3],
+        (uint32_t)counter, (uint32_t)(counter >> 32), block_len, flags,
+    };
+    round_c(v, block_words, 0);
+    round_c(v, block_words, 1);
+    round_c(v, block_words, 2);
+    round_c(v, block_words, 3);
+    round_c(v, block_words, 4);
+    round_c(v, block_words, 5);
+    round_c(v, block_words, 6);
+    out[0] = v[0] ^ v[8];
+    out[1] = v[1] ^ v[9];
+    out[2] = v[2] ^ v[10];
+    out[3] = v[3] ^ v[11];
+    out[4] = v[4] ^ v[12];
+    out[5] = v[5] ^ v[13];
+    out[6] = v[6] ^ v[14];
+    out[7] = v[7] ^ v[15];
+    out[8] = v[8] ^ cv[0];
+    out[9] = v[9] ^ cv[1];
+    out[10] = v[10] ^ cv[2];
+    out[11] = v[11] ^ cv[3];
+    out[12] = v[12] ^ cv[4];
+    out[13] = v[13] ^ cv[5];
+    out[14] = v[14] ^ cv[6];
+    out[15] = v[15] ^ cv[7];
+}
+
+#ifdef __AVX2__
+// Lane kernels keep word i of every lane in v[i], so a G step is the same
+// instruction sequence as the scalar one. Rows are transposed on the way in
+// and out; the NASM kernels do the same.
+static inline __m128i rot16_128(__m128i x) {
+    return _mm_shuffle_epi8(x, _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5,
+                                             10, 11, 8, 9, 14, 15, 12, 13));
+}
+
+static inline __m128i rot8_128(__m128i x) {
+    return _mm_shuffle_epi8(x, _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4,
+                                             9, 10, 11, 8, 13, 14, 15, 12));
+}
+
+static inline void g4_c(__m128i v[16],
+                        size_t a,
+                        size_t b,
+                        size_t c,
+                        size_t d,
+                        __m128i x,
+                        __m128i y) {
+    v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]), x);
+    v[d] = rot16_128(_mm_xor_si128(v[d], v[a]));
+    v[c] = _mm_add_epi32(v[c], v[d]);
+    v[b] = _mm_xor_si128(v[b], v[c]);
+    v[b] = _mm_or_si128(_mm_srli_epi32(v[b], 12), _mm_slli_epi32(v[b], 20));
+    v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]), y);
+    v[d] = rot8_128(_mm_xor_si128(v[d], v[a]));
+    v[c] = _mm_add_epi32(v[c], v[d]);
+    v[b] = _mm_xor_si128(v[b], v[c]);
+    v[b] = _mm_or_si128(_mm_srli_epi32(v[b], 7), _mm_slli_epi32(v[b], 25));
+}
+
+static inline void round4_c(__m128i v[16], const __m128i m[16], size_t r) {
+    const uint8_t *s = MSG_SCHEDULE[r];
+    g4_c(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    g4_c(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    g4_c(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    g4_c(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    g4_c(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    g4_c(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    g4_c(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    g4_c(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+}
+
+static inline void transpose4_c(__m128i v[4]) {
+    __m128i ab_lo = _mm_unpacklo_epi32(v[0], v[1]);
+    __m128i ab_hi = _mm_unpackhi_epi32(v[0], v[1]);
+    __m128i cd_lo = _mm_unpacklo_epi32(v[2], v[3]);
+    __m128i cd_hi = _mm_unpackhi_epi32(v[2], v[3]);
+    v[0] = _mm_unpacklo_epi64(ab_lo, cd_lo);
+    v[1] = _mm_unpackhi_epi64(ab_lo, cd_lo);
+    v[2] = _mm_unpacklo_epi64(ab_hi, cd_hi);
+    v[3] = _mm_unpackhi_epi64(ab_hi, cd_hi);
+}
+
+// Loads 16-byte column `col` of four rows and transposes it into words
+// 4 * col .. 4 * col + 3 of the lanes.
+static inline void load_cols4_c(__m128i out[4],
+                                const uint8_t *const rows[4],
+                                size_t col) {
+    out[0] = _mm_loadu_si128((const __m128i *)(rows[0] + 16 * col));
+    out[1] = _mm_loadu_si128((const __m128i *)(rows[1] + 16 * col));
+    out[2] = _mm_loadu_si128((const __m128i *)(rows[2] + 16 * col));
+    out[3] = _mm_loadu_si128((const __m128i *)(rows[3] + 16 * col));
+    transpose4_c(out);
+}
+
+static inline void store_cols4_c(uint8_t *const rows[4],
+                                 __m128i in[4],
+                                 size_t col) {
+    transpose4_c(in);
+    _mm_storeu_si128((__m128i *)(rows[0] + 16 * col), in[0]);
+    _mm_storeu_si128((__m128i *)(rows[1] + 16 * col), in[1]);
+    _mm_storeu_si128((__m128i *)(rows[2] + 16 * col), in[2]);
+    _mm_storeu_si128((__m128i *)(rows[3] + 16 * col), in[3]);
+}
+
+static inline void compress4_c(uint32_t cv[4][8],
+                               const uint8_t *blocks[4],
+                               const uint64_t counters[4],
+                               uint32_t block_len,
+                               uint32_t flags) {
+    uint8_t *rows[4] = {
+        (uint8_t *)cv[0], (uint8_t *)cv[1], (uint8_t *)cv[2], (uint8_t *)cv[3],
+    };
+    __m128i v[16];
+    __m128i m[16];
+    load_cols4_c(v, (const uint8_t *const *)rows, 0);
+    load_cols4_c(v + 4, (const uint8_t *const *)rows, 1);
+    v[8] = _mm_set1_epi32((int)IV[0]);
+    v[9] = _mm_set1_epi32((int)IV[1]);
+    v[10] = _mm_set1_epi32((int)IV[2]);
+    v[11] = _mm_set1_epi32((int)IV[3]);
+    v[12] = _mm_setr_epi32((int)counters[0], (int)counters[1],
+                           (int)counters[2], (int)counters[3]);
+    v[13] = _mm_setr_epi32((int)(counters[0] >> 32), (int)(counters[1] >> 32),
+                           (int)(counters[2] >> 32), (int)(counters[3] >> 32));
+    v[14] = _mm_set1_epi32((int)block_len);
+    v[15] = _mm_set1_epi32((int)flags);
+    load_cols4_c(m, blocks, 0);
+    load_cols4_c(m + 4, blocks, 1);
+    load_cols4_c(m + 8, blocks, 2);
+    load_cols4_c(m + 12, blocks, 3);
+    round4_c(v, m, 0);
+    round4_c(v, m, 1);
+    round4_c(v, m, 2);
+    round4_c(v, m, 3);
+    round4_c(v, m, 4);
+    round4_c(v, m, 5);
+    round4_c(v, m, 6);
+    __m128i lo[4] = {
+        _mm_xor_si128(v[0], v[8]), _mm_xor_si128(v[1], v[9]),
+        _mm_xor_si128(v[2], v[10]), _mm_xor_si128(v[3], v[11]),
+    };
+    __m128i hi[4] = {
+        _mm_xor_si128(v[4], v[12]), _mm_xor_si128(v[5], v[13]),
+        _mm_xor_si128(v[6], v[14]), _mm_xor_si128(v[7], v[15]),
+    };
+    store_cols4_c(rows, lo, 0);
+    store_cols4_c(rows, hi, 1);
+}
+
+static inline __m256i rot16_256(__m256i x) {
+    return _mm256_shuffle_epi8(x, _mm256_setr_epi8(
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13));
+}
+
+static inline __m256i rot8_256(__m256i x) {
+    return _mm256_shuffle_epi8(x, _mm256_setr_epi8(
+        1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+        1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12));
+}
+
+static inline void g8_c(__m256i v[16],
+                        size_t a,
+                        size_t b,
+                        size_t c,
+                        size_t d,
+                        __m256i x,
+                        __m256i y) {
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x);
+    v[d] = rot16_256(_mm256_xor_si256(v[d], v[a]));
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+    v[b] = _mm256_xor_si256(v[b], v[c]);
+    v[b] = _mm256_or_si256(_mm256_srli_epi32(v[b], 12),
+                           _mm256_slli_epi32(v[b], 20));
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y);
+    v[d] = rot8_256(_mm256_xor_si256(v[d], v[a]));
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+    v[b] = _mm256_xor_si256(v[b], v[c]);
+    v[b] = _mm256_or_si256(_mm256_srli_epi32(v[b], 7),
+                           _mm256_slli_epi32(v[b], 25));
+}
+
+static inline void round8_c(__m256i v[16], const __m256i m[16], size_t r) {
+    const uint8_t *s = MSG_SCHEDULE[r];
+    g8_c(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    g8_c(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    g8_c(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    g8_c(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    g8_c(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    g8_c(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    g8_c(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    g8_c(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+}
+
+static inline void transpose8_c(__m256i v[8]) {
+    __m256i ab_lo = _mm256_unpacklo_epi32(v[0], v[1]);
+    __m256i ab_hi = _mm256_unpackhi_epi32(v[0], v[1]);
+    __m256i cd_lo = _mm256_unpacklo_epi32(v[2], v[3]);
+    __m256i cd_hi = _mm256_unpackhi_epi32(v[2], v[3]);
+    __m256i ef_lo = _mm256_unpacklo_epi32(v[4], v[5]);
+    __m256i ef_hi = _mm256_unpackhi_epi32(v[4], v[5]);
+    __m256i gh_lo = _mm256_unpacklo_epi32(v[6], v[7]);
+    __m256i gh_hi = _mm256_unpackhi_epi32(v[6], v[7]);
+    __m256i abcd_0 = _mm256_unpacklo_epi64(ab_lo, cd_lo);
+    __m256i abcd_1 = _mm256_unpackhi_epi64(ab_lo, cd_lo);
+    __m256i abcd_2 = _mm256_unpacklo_epi64(ab_hi, cd_hi);
+    __m256i abcd_3 = _mm256_unpackhi_epi64(ab_hi, cd_hi);
+    __m256i efgh_0 = _mm256_unpacklo_epi64(ef_lo, gh_lo);
+    __m256i efgh_1 = _mm256_unpackhi_epi64(ef_lo, gh_lo);
+    __m256i efgh_2 = _mm256_unpacklo_epi64(ef_hi, gh_hi);
+    __m256i efgh_3 = _mm256_unpackhi_epi64(ef_hi, gh_hi);
+    v[0] = _mm256_permute2x128_si256(abcd_0, efgh_0, 0x20);
+    v[1] = _mm256_permute2x128_si256(abcd_1, efgh_1, 0x20);
+    v[2] = _mm256_permute2x128_si256(abcd_2, efgh_2, 0x20);
+    v[3] = _mm256_permute2x128_si256(abcd_3, efgh_3, 0x20);
+    v[4] = _mm256_permute2x128_si256(abcd_0, efgh_0, 0x31);
+    v[5] = _mm256_permute2x128_si256(abcd_1, efgh_1, 0x31);
+    v[6] = _mm256_permute2x128_si256(abcd_2, efgh_2, 0x31);
+    v[7] = _mm256_permute2x128_si256(abcd_3, efgh_3, 0x31);
+}
+
+static inline void load_cols8_c(__m256i out[8],
+                                const uint8_t *const rows[8],
+                                size_t col) {
+    out[0] = _mm256_loadu_si256((const __m256i *)(rows[0] + 32 * col));
+    out[1] = _mm256_loadu_si256((const __m256i *)(rows[1] + 32 * col));
+    out[2] = _mm256_loadu_si256((const __m256i *)(rows[2] + 32 * col));
+    out[3] = _mm256_loadu_si256((const __m256i *)(rows[3] + 32 * col));
+    out[4] = _mm256_loadu_si256((const __m256i *)(rows[4] + 32 * col));
+    out[5] = _mm256_loadu_si256((const __m256i *)(rows[5] + 32 * col));
+    out[6] = _mm256_loadu_si256((const __m256i *)(rows[6] + 32 * col));
+    out[7] = _mm256_loadu_si256((const __m256i *)(rows[7] + 32 * col));
+    transpose8_c(out);
+}
+
+static inline __m256i counter_words8_c(const uint64_t counters[8], int shift) {
+    return _mm256_setr_epi32((int)(counters[0] >> shift),
+                             (int)(counters[1] >> shift),
+                             (int)(counters[2] >> shift),
+                             (int)(counters[3] >> shift),
+                             (int)(counters[4] >> shift),
+                             (int)(counters[5] >> shift),
+                             (int)(counters[6] >> shift),
+                             (int)(counters[7] >> shift));
+}
+
+static inline void compress8_c(uint32_t cv[8][8],
+                               const uint8_t *blocks[8],
+                               const uint64_t counters[8],
+                               uint32_t block_len,
+                               uint32_t flags) {
+    const uint8_t *rows[8] = {
+        (const uint8_t *)cv[0], (const uint8_t *)cv[1],
+        (const uint8_t *)cv[2], (const uint8_t *)cv[3],
+        (const uint8_t *)cv[4], (const uint8_t *)cv[5],
+        (const uint8_t *)cv[6], (const uint8_t *)cv[7],
+    };
+    __m256i v[16];
+    __m256i m[16];
+    load_cols8_c(v, rows, 0);
+    v[8] = _mm256_set1_epi32((int)IV[0]);
+    v[9] = _mm256_set1_epi32((int)IV[1]);
+    v[10] = _mm256_set1_epi32((int)IV[2]);
+    v[11] = _mm256_set1_epi32((int)IV[3]);
+    v[12] = counter_words8_c(counters, 0);
+    v[13] = counter_words8_c(counters, 32);
+    v[14] = _mm256_set1_epi32((int)block_len);
+    v[15] = _mm256_set1_epi32((int)flags);
+    load_cols8_c(m, blocks, 0);
+    load_cols8_c(m + 8, blocks, 1);
+    round8_c(v, m, 0);
+    round8_c(v, m, 1);
+    round8_c(v, m, 2);
+    round8_c(v, m, 3);
+    round8_c(v, m, 4);
+    round8_c(v, m, 5);
+    round8_c(v, m, 6);
+    __m256i out[8] = {
+        _mm256_xor_si256(v[0], v[8]), _mm256_xor_si256(v[1], v[9]),
+        _mm256_xor_si256(v[2], v[10]), _mm256_xor_si256(v[3], v[11]),
+        _mm256_xor_si256(v[4], v[12]), _mm256_xor_si256(v[5], v[13]),
+        _mm256_xor_si256(v[6], v[14]), _mm256_xor_si256(v[7], v[15]),
+    };
+    transpose8_c(out);
+    _mm256_storeu_si256((__m256i *)cv[0], out[0]);
+    _mm256_storeu_si256((__m256i *)cv[1], out[1]);
+    _mm256_storeu_si256((__m256i *)cv[2], out[2]);
+    _mm256_storeu_si256((__m256i *)cv[3], out[3]);
+    _mm256_storeu_si256((__m256i *)cv[4], out[4]);
+    _mm256_storeu_si256((__m256i *)cv[5], out[5]);
+    _mm256_storeu_si256((__m256i *)cv[6], out[6]);
+    _mm256_storeu_si256((__m256i *)cv[7], out[7]);
+}
+#endif
+
+#ifdef FP_BLAKE3_NO_ASM
+static FpBlake3Kernels kernel_set = FP_BLAKE3_KERNELS_C;
+#else
+static FpBlake3Kernels kernel_set = FP_BLAKE3_KERNELS_ASM;
+#endif
+
 static void compress(const uint32_t cv[8],
                      const uint32_t block_words[16],
                      uint64_t counter,
                      uint32_t block_len,
                      uint32_t flags,
                      uint32_t out[16]) {
-    fp_blake3_compress_words_asm(cv, block_words, counter, block_len, flags, out);
+#ifndef FP_BLAKE3_NO_ASM
+    if (kernel_set == FP_BLAKE3_KERNELS_ASM) {
+        fp_blake3_compress_words_asm(cv, block_words, counter, block_len, flags,
+                                     out);
+        return;
+    }
+#endif
+    compress_c(cv, block_words, counter, block_len, flags, out);
+}
+
+#ifdef __AVX2__
+// The NASM lane kernels only take full blocks; shorter ones go through the
+// C kernels whichever set is selected.
+static void compress4(uint32_t cv[4][8],
+                      const uint8_t *blocks[4],
+                      const uint64_t counters[4],
+                      uint32_t block_len,
+                      uint32_t flags) {
+#ifndef FP_BLAKE3_NO_ASM
+    if (kernel_set == FP_BLAKE3_KERNELS_ASM &&
+        block_len == FP_BLAKE3_BLOCK_LEN) {
+        fp_blake3_compress4_asm(cv, blocks, counters, flags);
+        return;
+    }
+#endif
+    compress4_c(cv, blocks, counters, block_len, flags);
+}
+
+static void compress8(uint32_t cv[8][8],
+                      const uint8_t *blocks[8],
+                      const uint64_t counters[8],
+                      uint32_t block_len,
+                      uint32_t flags) {
+#ifndef FP_BLAKE3_NO_ASM
+    if (kernel_set == FP_BLAKE3_KERNELS_ASM &&
+        block_len == FP_BLAKE3_BLOCK_LEN) {
+        fp_blake3_compress8_asm(cv, blocks, counters, flags);
+        return;
+    }
+#endif
+    compress8_c(cv, blocks, counters, block_len, flags);
 }
+#endif
 
 static void compress_cv(uint32_t cv[8],
                         const uint32_t block_words[16],
@@ -119,6 +525,9 @@ static void output_chaining_value(const output *o, uint32_t out_cv[8]) {
     uint32_t cv[8];
     memcpy(cv, o->input_cv, sizeof(cv));
     compress_cv(cv, o->block_words, o->counter, o->block_len, o->flags);        
+    if (o->flags & PARENT) {
+        STATS_COUNT(parent_compressions, 1);
+    }
     memcpy(out_cv, cv, sizeof(cv));
 }
 
@@ -152,6 +561,8 @@ static void output_root_bytes_rec(const output *o,
              o->block_len,
              o->flags | ROOT,
              out_words);
+    STATS_COUNT(xof_compressions, 1);
+    STATS_COUNT(xof_bytes, out_len < 64 ? out_len : 64);
     output_words_rec(out_words, &out, &out_len, 0);
     output_root_bytes_rec(o, out, out_len, output_counter + 1);
 }
@@ -174,7 +585,6 @@ static void chunk_state_init(FpBlake3Hasher *h,
     h->block_len = 0;
     h->blocks_compressed = 0;
     h->flags = flags;
-    memset(h->block, 0, sizeof(h->block));
 }
 
 static size_t chunk_state_len(const FpBlake3Hasher *h) {
@@ -201,7 +611,6 @@ static void chunk_state_update_rec(FpBlake3Hasher *h,
                     h->flags | chunk_state_start_flag(h));
         h->blocks_compressed++;
         h->block_len = 0;
-        memset(h->block, 0, sizeof(h->block));
         chunk_state_update_rec(h, input, len);
         return;
     }
@@ -218,7 +627,9 @@ static void chunk_state_update_rec(FpBlake3Hasher *h,
 static void chunk_state_update(FpBlake3Hasher *h,
                                const uint8_t *input,
                                size_t len) {
+    uint64_t t0 = STATS_BEGIN();
     chunk_state_update_rec(h, input, len);
+    STATS_KERNEL(partial, len, t0);
 }
 
 static output chunk_state_output(const FpBlake3Hasher *h) {
@@ -258,12 +669,13 @@ static output parent_output(const uint32_t left[8],
     return out;
 }
 
-static void chunk_cv_full_rec(uint32_t state[8],
-                              const uint8_t *block_ptr,
-                              uint64_t chunk_counter,
-                              uint32_t base_flags,
-                              size_t block_idx) {
-    if (block_idx == (FP_BLAKE3_CHUNK_LEN / FP_BLAKE3_BLOCK_LEN)) {
+static void chunk_cv_blocks_rec(uint32_t state[8],
+                                const uint8_t *block_ptr,
+                                uint64_t chunk_counter,
+                                uint32_t base_flags,
+                                size_t block_idx,
+                                size_t blocks) {
+    if (block_idx == blocks) {
         return;
     }
     uint32_t block_words[16];
@@ -277,11 +689,12 @@ static void chunk_cv_full_rec(uint32_t state[8],
     load_words(block_words, block_ptr);
     compress_cv(state, block_words, chunk_counter,
                 FP_BLAKE3_BLOCK_LEN, block_flags);
-    chunk_cv_full_rec(state,
-                      block_ptr + FP_BLAKE3_BLOCK_LEN,
-                      chunk_counter,
-                      base_flags,
-                      block_idx + 1);
+    chunk_cv_blocks_rec(state,
+                        block_ptr + FP_BLAKE3_BLOCK_LEN,
+                        chunk_counter,
+                        base_flags,
+                        block_idx + 1,
+                        blocks);
 }
 
 static void chunk_cv_full(const uint8_t *input,
@@ -291,7 +704,8 @@ static void chunk_cv_full(const uint8_t *input,
                           uint32_t out_cv[8]) {
     uint32_t cv[8];
     memcpy(cv, key_words, sizeof(cv));
-    chunk_cv_full_rec(cv, input, counter, flags, 0);
+    chunk_cv_blocks_rec(cv, input, counter, flags, 0,
+                        FP_BLAKE3_CHUNK_LEN / FP_BLAKE3_BLOCK_LEN);
     memcpy(out_cv, cv, sizeof(cv));
 }
 
@@ -338,7 +752,9 @@ static void chunk_cvs_scalar(const uint8_t *input,
     if (chunks == 0) {
         return;
     }
+    uint64_t t0 = STATS_BEGIN();
     chunk_cv_full(input, key_words, counter, flags, out[0]);
+    STATS_KERNEL(scalar, FP_BLAKE3_CHUNK_LEN, t0);
     chunk_cvs_scalar(input + FP_BLAKE3_CHUNK_LEN,
                      chunks - 1,
                      key_words,
@@ -347,7 +763,6 @@ static void chunk_cvs_scalar(const uint8_t *input,
                      out + 1);
 }
 
-#ifdef __AVX2__
 static uint32_t block_flags_for_index(uint32_t flags, size_t block_idx) {
     uint32_t block_flags = flags;
     if (block_idx == 0) {
@@ -359,6 +774,7 @@ static uint32_t block_flags_for_index(uint32_t flags, size_t block_idx) {
     return block_flags;
 }
 
+#ifdef __AVX2__
 static void fill_counters_rec(uint64_t *counters,
                               size_t lanes,
                               uint64_t counter) {
@@ -389,6 +805,19 @@ static void copy_cv_lanes_rec(uint32_t (*dst)[8],
     copy_cv_lanes_rec(dst + 1, src + 1, lanes - 1);
 }
 
+static void compress_lanes(uint32_t (*cv)[8],
+                           const uint8_t **blocks,
+                           const uint64_t *counters,
+                           uint32_t block_len,
+                           uint32_t flags,
+                           size_t lanes) {
+    if (lanes == 8) {
+        compress8(cv, blocks, counters, block_len, flags);
+        return;
+    }
+    compress4(cv, blocks, counters, block_len, flags);
+}
+
 static void chunk_cvs_blocks4_rec(uint32_t cv[4][8],
                                   const uint8_t *input,
                                   const uint64_t counters[4],
@@ -405,7 +834,8 @@ static void chunk_cvs_blocks4_rec(uint32_t cv[4][8],
         input + (2 * FP_BLAKE3_CHUNK_LEN) + block_offset,
         input + (3 * FP_BLAKE3_CHUNK_LEN) + block_offset,
     };
-    fp_blake3_compress4_asm(cv, blocks, counters, block_flags);
+    compress4(cv, blocks, counters, FP_BLAKE3_BLOCK_LEN,
+              block_flags);
     chunk_cvs_blocks4_rec(cv, input, counters, flags, block_idx + 1);
 }
 
@@ -429,64 +859,308 @@ static void chunk_cvs_blocks8_rec(uint32_t cv[8][8],
         input + (6 * FP_BLAKE3_CHUNK_LEN) + block_offset,
         input + (7 * FP_BLAKE3_CHUNK_LEN) + block_offset,
     };
-    fp_blake3_compress8_asm(cv, blocks, counters, block_flags);
+    compress8(cv, blocks, counters, FP_BLAKE3_BLOCK_LEN,
+              block_flags);
     chunk_cvs_blocks8_rec(cv, input, counters, flags, block_idx + 1);
 }
 
-static void chunk_cvs_avx2_rec(const uint8_t *input,
+static void chunk_cvs_simd8(const uint8_t *input,
+                            size_t chunks,
+                            const uint32_t key_words[8],
+                            uint64_t counter,
+                            uint32_t flags,
+                            uint32_t out[][8]) {
+    (void)chunks;
+    uint32_t cv[8][8];
+    uint64_t counters[8];
+    fill_counters_rec(counters, 8, counter);
+    init_cv_lanes_rec(cv, 8, key_words);
+    uint64_t t0 = STATS_BEGIN();
+    chunk_cvs_blocks8_rec(cv, input, counters, flags, 0);
+    STATS_KERNEL(simd8, 8 * FP_BLAKE3_CHUNK_LEN, t0);
+    copy_cv_lanes_rec(out, cv, 8);
+}
+
+static void chunk_cvs_simd4(const uint8_t *input,
+                            size_t chunks,
+                            const uint32_t key_words[8],
+                            uint64_t counter,
+                            uint32_t flags,
+                            uint32_t out[][8]) {
+    (void)chunks;
+    uint32_t cv[4][8];
+    uint64_t counters[4];
+    fill_counters_rec(counters, 4, counter);
+    init_cv_lanes_rec(cv, 4, key_words);
+    uint64_t t0 = STATS_BEGIN();
+    chunk_cvs_blocks4_rec(cv, input, counters, flags, 0);
+    STATS_KERNEL(simd4, 4 * FP_BLAKE3_CHUNK_LEN, t0);
+    copy_cv_lanes_rec(out, cv, 4);
+}
+#endif
+
+static const FpBlake3Dispatch DISPATCH_DEFAULTS = {
+    .simd4_min_chunks = 2,
+    .simd8_min_chunks = 5,
+    .batch_chunks = 8,
+    .prefetch_bytes = 0,
+};
+
+static FpBlake3Dispatch dispatch_cfg = {
+    .simd4_min_chunks = 2,
+    .simd8_min_chunks = 5,
+    .batch_chunks = 8,
+    .prefetch_bytes = 0,
+};
+
+#ifdef __AVX2__
+static const uint8_t zero_block[FP_BLAKE3_BLOCK_LEN];
+
+static void masked_blocks_rec(const uint8_t **blocks,
+                              const uint8_t *const *lane_inputs,
+                              const size_t *lane_blocks,
+                              size_t lanes,
+                              size_t block_idx) {
+    if (lanes == 0) {
+        return;
+    }
+    blocks[0] = lane_blocks[0] > block_idx
+        ? lane_inputs[0] + block_idx * FP_BLAKE3_BLOCK_LEN
+        : zero_block;
+    masked_blocks_rec(blocks + 1, lane_inputs + 1, lane_blocks + 1,
+                      lanes - 1, block_idx);
+}
+
+static void masked_done_rec(uint32_t (*done)[8],
+                            uint32_t (*cv)[8],
+                            const size_t *lane_blocks,
+                            size_t lanes,
+                            size_t block_idx) {
+    if (lanes == 0) {
+        return;
+    }
+    if (lane_blocks[0] == block_idx + 1) {
+        memcpy(done[0], cv[0], sizeof(done[0]));
+    }
+    masked_done_rec(done + 1, cv + 1, lane_blocks + 1, lanes - 1, block_idx);
+}
+
+static void chunk_lanes_masked_rec(uint32_t (*cv)[8],
+                                   uint32_t (*done)[8],
+                                   const uint8_t *const *lane_inputs,
+                                   const size_t *lane_blocks,
+                                   const uint64_t *counters,
+                                   uint32_t flags,
+                                   size_t lanes,
+                                   size_t block_idx,
+                                   size_t max_blocks) {
+    if (block_idx == max_blocks) {
+        return;
+    }
+    const uint8_t *blocks[8];
+    masked_blocks_rec(blocks, lane_inputs, lane_blocks, lanes, block_idx);
+    compress_lanes(cv, blocks, counters, FP_BLAKE3_BLOCK_LEN,
+                   block_flags_for_index(flags, block_idx), lanes);
+    masked_done_rec(done, cv, lane_blocks, lanes, block_idx);
+    chunk_lanes_masked_rec(cv, done, lane_inputs, lane_blocks, counters,
+                           flags, lanes, block_idx + 1, max_blocks);
+}
+
+static void masked_lanes_init_rec(const uint8_t **lane_inputs,
+                                  size_t *lane_blocks,
+                                  const uint8_t *input,
+                                  size_t lane,
+                                  size_t lanes,
+                                  size_t chunks,
+                                  size_t tail_blocks) {
+    if (lane == lanes) {
+        return;
+    }
+    lane_inputs[lane] = input + lane * FP_BLAKE3_CHUNK_LEN;
+    lane_blocks[lane] = lane < chunks
+        ? FP_BLAKE3_CHUNK_LEN / FP_BLAKE3_BLOCK_LEN
+        : (lane == chunks ? tail_blocks : 0);
+    masked_lanes_init_rec(lane_inputs, lane_blocks, input, lane + 1, lanes,
+                          chunks, tail_blocks);
+}
+
+// Runs fewer than `lanes` chunks, plus an optional partial tail chunk of
+// tail_blocks blocks, through one pass of the 4/8-way kernel. Idle lanes read
+// a zero block and their results are discarded.
+static void chunk_cvs_masked(const uint8_t *input,
+                             size_t chunks,
+                             size_t tail_blocks,
+                             size_t lanes,
+                             const uint32_t key_words[8],
+                             uint64_t counter,
+                             uint32_t flags,
+                             uint32_t out[][8],
+                             uint32_t tail_cv[8]) {
+    uint32_t cv[8][8];
+    uint32_t done[8][8];
+    uint64_t counters[8];
+    const uint8_t *lane_inputs[8];
+    size_t lane_blocks[8];
+    fill_counters_rec(counters, lanes, counter);
+    init_cv_lanes_rec(cv, lanes, key_words);
+    masked_lanes_init_rec(lane_inputs, lane_blocks, input, 0, lanes,
+                          chunks, tail_blocks);
+    uint64_t t0 = STATS_BEGIN();
+    chunk_lanes_masked_rec(cv, done, lane_inputs, lane_blocks, counters,
+                           flags, lanes, 0,
+                           chunks > 0 ? FP_BLAKE3_CHUNK_LEN /
+                                            FP_BLAKE3_BLOCK_LEN
+                                      : tail_blocks);
+    size_t nbytes = chunks * FP_BLAKE3_CHUNK_LEN +
+        tail_blocks * FP_BLAKE3_BLOCK_LEN;
+    if (lanes == 8) {
+        STATS_KERNEL(simd8, nbytes, t0);
+    } else {
+        STATS_KERNEL(simd4, nbytes, t0);
+    }
+    copy_cv_lanes_rec(out, done, chunks);
+    if (tail_blocks > 0) {
+        memcpy(tail_cv, done[chunks], sizeof(done[0]));
+    }
+}
+
+static void chunk_cvs_avx2_rec(const FpBlake3Dispatch *cfg,
+                               const uint8_t *input,
+                               size_t chunks,
+                               size_t tail_blocks,
+                               const uint32_t key_words[8],
+                               uint64_t counter,
+                               uint32_t flags,
+                               uint32_t out[][8],
+                               uint32_t tail_cv[8]);
+#endif
+
+static void chunk_cvs_scalar_tail(const uint8_t *input,
+                                  size_t chunks,
+                                  size_t tail_blocks,
+                                  const uint32_t key_words[8],
+                                  uint64_t counter,
+                                  uint32_t flags,
+                                  uint32_t out[][8],
+                                  uint32_t tail_cv[8]) {
+    chunk_cvs_scalar(input, chunks, key_words, counter, flags, out);
+    if (tail_blocks > 0) {
+        uint64_t t0 = STATS_BEGIN();
+        memcpy(tail_cv, key_words, sizeof(uint32_t) * 8);
+        chunk_cv_blocks_rec(tail_cv,
+                            input + chunks * FP_BLAKE3_CHUNK_LEN,
+                            counter + chunks,
+                            flags,
+                            0,
+                            tail_blocks);
+        STATS_KERNEL(scalar, tail_blocks * FP_BLAKE3_BLOCK_LEN, t0);
+    }
+}
+
+#ifdef __AVX2__
+static void prefetch_lines_rec(const uint8_t *p, size_t lines) {
+    if (lines == 0) {
+        return;
+    }
+    _mm_prefetch((const char *)p, _MM_HINT_T0);
+    prefetch_lines_rec(p + 64, lines - 1);
+}
+
+static void chunk_cvs_avx2_rec(const FpBlake3Dispatch *cfg,
+                               const uint8_t *input,
                                size_t chunks,
+                               size_t tail_blocks,
                                const uint32_t key_words[8],
                                uint64_t counter,
                                uint32_t flags,
-                               uint32_t out[][8]) {
-    if (chunks >= 8) {
-        uint32_t cv[8][8];
-        uint64_t counters[8];
-        fill_counters_rec(counters, 8, counter);
-        init_cv_lanes_rec(cv, 8, key_words);
-        chunk_cvs_blocks8_rec(cv, input, counters, flags, 0);
-        copy_cv_lanes_rec(out, cv, 8);
-        chunk_cvs_avx2_rec(input + (8 * FP_BLAKE3_CHUNK_LEN),
+                               uint32_t out[][8],
+                               uint32_t tail_cv[8]) {
+    size_t lanes = chunks + (tail_blocks > 0 ? 1 : 0);
+    if (cfg->prefetch_bytes != 0 && chunks >= 8) {
+        // Each 8-way pass reads 8 chunks; pull in the ones prefetch_bytes
+        // ahead of it. Lines past the end of the input are harmless.
+        prefetch_lines_rec(input + cfg->prefetch_bytes,
+                           8 * FP_BLAKE3_CHUNK_LEN / 64);
+    }
+    if (lanes >= cfg->simd8_min_chunks) {
+        if (chunks < 8) {
+            chunk_cvs_masked(input, chunks, tail_blocks, 8, key_words,
+                             counter, flags, out, tail_cv);
+            return;
+        }
+        chunk_cvs_simd8(input, 8, key_words, counter, flags, out);
+        chunk_cvs_avx2_rec(cfg,
+                           input + (8 * FP_BLAKE3_CHUNK_LEN),
                            chunks - 8,
+                           tail_blocks,
                            key_words,
                            counter + 8,
                            flags,
-                           out + 8);
+                           out + 8,
+                           tail_cv);
         return;
     }
-    if (chunks >= 4) {
-        uint32_t cv[4][8];
-        uint64_t counters[4];
-        fill_counters_rec(counters, 4, counter);
-        init_cv_lanes_rec(cv, 4, key_words);
-        chunk_cvs_blocks4_rec(cv, input, counters, flags, 0);
-        copy_cv_lanes_rec(out, cv, 4);
-        chunk_cvs_avx2_rec(input + (4 * FP_BLAKE3_CHUNK_LEN),
+    if (lanes >= cfg->simd4_min_chunks) {
+        if (chunks < 4) {
+            chunk_cvs_masked(input, chunks, tail_blocks, 4, key_words,
+                             counter, flags, out, tail_cv);
+            return;
+        }
+        chunk_cvs_simd4(input, 4, key_words, counter, flags, out);
+        chunk_cvs_avx2_rec(cfg,
+                           input + (4 * FP_BLAKE3_CHUNK_LEN),
                            chunks - 4,
+                           tail_blocks,
                            key_words,
                            counter + 4,
                            flags,
-                           out + 4);
+                           out + 4,
+                           tail_cv);
         return;
     }
-    chunk_cvs_scalar(input, chunks, key_words, counter, flags, out);
+    chunk_cvs_scalar_tail(input, chunks, tail_blocks, key_words, counter,
+                          flags, out, tail_cv);
 }
 #endif
 
+// Computes the CVs of `chunks` full chunks and, when tail_blocks > 0, the
+// running CV after the first tail_blocks blocks of the partial chunk that
+// follows them, so the hasher's last chunk shares SIMD lanes with the rest.
+static void chunk_cvs_tail(const FpBlake3Dispatch *cfg,
+                           const uint8_t *input,
+                           size_t chunks,
+                           size_t tail_blocks,
+                           const uint32_t key_words[8],
+                           uint64_t counter,
+                           uint32_t flags,
+                           uint32_t out[][8],
+                           uint32_t tail_cv[8]) {
+#ifdef __AVX2__
+    size_t simd_min_chunks = cfg->simd4_min_chunks;
+    if (cfg->simd8_min_chunks < simd_min_chunks) {
+        simd_min_chunks = cfg->simd8_min_chunks;
+    }
+    size_t lanes = chunks + (tail_blocks > 0 ? 1 : 0);
+    if (lanes >= simd_min_chunks && have_avx2()) {
+        chunk_cvs_avx2_rec(cfg, input, chunks, tail_blocks, key_words,
+                           counter, flags, out, tail_cv);
+        return;
+    }
+#else
+    (void)cfg;
+#endif
+    chunk_cvs_scalar_tail(input, chunks, tail_blocks, key_words, counter,
+                          flags, out, tail_cv);
+}
+
 static void chunk_cvs(const uint8_t *input,
                       size_t chunks,
                       const uint32_t key_words[8],
                       uint64_t counter,
                       uint32_t flags,
                       uint32_t out[][8]) {
-#ifdef __AVX2__
-    const size_t avx2_min_chunks = 4;
-    if (chunks >= avx2_min_chunks && have_avx2()) {
-        chunk_cvs_avx2_rec(input, chunks, key_words, counter, flags, out);
-        return;
-    }
-#endif
-    chunk_cvs_scalar(input, chunks, key_words, counter, flags, out);
+    chunk_cvs_tail(&dispatch_cfg, input, chunks, 0, key_words, counter, flags,
+                   out, NULL);
 }
 
 static void push_stack(FpBlake3Hasher *h, const uint32_t cv[8]) {
@@ -525,22 +1199,42 @@ static uint64_t add_chunk_cv_batch_rec(FpBlake3Hasher *h,
     return add_chunk_cv_batch_rec(h, cv_batch + 1, batch - 1, total_chunks);
 }
 
-static uint64_t process_full_chunks_rec(FpBlake3Hasher *h,
-                                        const uint8_t *input,
-                                        size_t full_chunks,
-                                        uint64_t chunk_counter) {
-    if (full_chunks == 0) {
-        return chunk_counter;
+// Hashes one batch and merges its CVs. Kept out of process_chunks_rec so
+// cv_batch is gone before the recursive call, which can then be a sibling
+// call that runs in constant stack.
+static uint64_t process_batch(const FpBlake3Dispatch *cfg,
+                              FpBlake3Hasher *h,
+                              const uint8_t *input,
+                              size_t batch,
+                              size_t batch_tail,
+                              uint64_t chunk_counter) {
+    uint32_t cv_batch[FP_BLAKE3_MAX_BATCH_CHUNKS][8];
+    chunk_cvs_tail(cfg, input, batch, batch_tail, h->key_words,
+                   chunk_counter, h->flags, cv_batch, h->cv);
+    return add_chunk_cv_batch_rec(h, cv_batch, batch, chunk_counter);
+}
+
+static void process_chunks_rec(const FpBlake3Dispatch *cfg,
+                               FpBlake3Hasher *h,
+                               const uint8_t *input,
+                               size_t full_chunks,
+                               size_t tail_blocks,
+                               uint64_t chunk_counter) {
+    size_t batch = full_chunks > cfg->batch_chunks
+        ? cfg->batch_chunks
+        : full_chunks;
+    size_t batch_tail = batch == full_chunks ? tail_blocks : 0;
+    uint64_t next_counter = process_batch(cfg, h, input, batch, batch_tail,
+                                          chunk_counter);
+    if (batch == full_chunks) {
+        return;
     }
-    size_t batch = full_chunks > 8 ? 8 : full_chunks;
-    uint32_t cv_batch[8][8];
-    chunk_cvs(input, batch, h->key_words, chunk_counter, h->flags, cv_batch);
-    uint64_t next_counter =
-        add_chunk_cv_batch_rec(h, cv_batch, batch, chunk_counter);
-    return process_full_chunks_rec(h,
-                                   input + (batch * FP_BLAKE3_CHUNK_LEN),
-                                   full_chunks - batch,
-                                   next_counter);
+    process_chunks_rec(cfg,
+                       h,
+                       input + (batch * FP_BLAKE3_CHUNK_LEN),
+                       full_chunks - batch,
+                       tail_blocks,
+                       next_counter);
 }
 
 static void fp_blake3_hasher_update_rec(FpBlake3Hasher *h,
@@ -550,22 +1244,23 @@ static void fp_blake3_hasher_update_rec(FpBlake3Hasher *h,
         return;
     }
     size_t state_len = chunk_state_len(h);
-    if (state_len == 0 && len >= FP_BLAKE3_CHUNK_LEN) {
-        size_t full_chunks = len / FP_BLAKE3_CHUNK_LEN;
-        if (len % FP_BLAKE3_CHUNK_LEN == 0 && full_chunks > 0) {
-            full_chunks--;
-        }
-        if (full_chunks > 0) {
-            uint64_t next_counter =
-                process_full_chunks_rec(h, input, full_chunks,
-                                        h->chunk_counter);
-            chunk_state_init(h, h->key_words, next_counter, h->flags);
-            size_t consumed = full_chunks * FP_BLAKE3_CHUNK_LEN;
-            fp_blake3_hasher_update_rec(h,
-                                        input + consumed,
-                                        len - consumed);
-            return;
-        }
+    if (state_len == 0 && len > FP_BLAKE3_BLOCK_LEN) {
+        // Everything but the final block stays zero-copy: full chunks and
+        // the leading blocks of the last chunk share SIMD lanes, and only
+        // the last (possibly root) block is staged for finalize.
+        size_t full_chunks = (len - 1) / FP_BLAKE3_CHUNK_LEN;
+        size_t tail_len = len - full_chunks * FP_BLAKE3_CHUNK_LEN;
+        size_t tail_blocks = (tail_len - 1) / FP_BLAKE3_BLOCK_LEN;
+        size_t last_len = tail_len - tail_blocks * FP_BLAKE3_BLOCK_LEN;
+        uint64_t chunk_counter = h->chunk_counter;
+        chunk_state_init(h, h->key_words, chunk_counter + full_chunks,
+                         h->flags);
+        process_chunks_rec(&dispatch_cfg, h, input, full_chunks, tail_blocks,
+                           chunk_counter);
+        h->blocks_compressed = (uint8_t)tail_blocks;
+        h->block_len = (uint8_t)last_len;
+        memcpy(h->block, input + (len - last_len), last_len);
+        return;
     }
 
     if (state_len == FP_BLAKE3_CHUNK_LEN) {
@@ -587,6 +1282,52 @@ static void fp_blake3_hasher_update_rec(FpBlake3Hasher *h,
     fp_blake3_hasher_update_rec(h, input + want, len - want);
 }
 
+static output single_chunk_output_rec(uint32_t cv[8],
+                                     const uint8_t *input,
+                                     size_t len,
+                                     uint32_t flags,
+                                     uint32_t start_flag) {
+    if (len > FP_BLAKE3_BLOCK_LEN) {
+        uint32_t block_words[16];
+        load_words(block_words, input);
+        compress_cv(cv, block_words, 0, FP_BLAKE3_BLOCK_LEN,
+                    flags | start_flag);
+        return single_chunk_output_rec(cv,
+                                       input + FP_BLAKE3_BLOCK_LEN,
+                                       len - FP_BLAKE3_BLOCK_LEN,
+                                       flags,
+                                       0);
+    }
+    output out;
+    uint8_t block[FP_BLAKE3_BLOCK_LEN] = {0};
+    if (len > 0) {
+        memcpy(block, input, len);
+    }
+    load_words(out.block_words, block);
+    memcpy(out.input_cv, cv, sizeof(out.input_cv));
+    out.counter = 0;
+    out.block_len = (uint32_t)len;
+    out.flags = flags | start_flag | CHUNK_END;
+    return out;
+}
+
+static output single_chunk_output(const uint32_t key_words[8],
+                                  const uint8_t *input,
+                                  size_t len,
+                                  uint32_t flags) {
+    uint32_t cv[8];
+    memcpy(cv, key_words, sizeof(cv));
+    return single_chunk_output_rec(cv, input, len, flags, CHUNK_START);
+}
+
+static void store_cv_bytes_rec(uint8_t *out, const uint32_t *cv, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    store32_le(out, cv[0]);
+    store_cv_bytes_rec(out + 4, cv + 1, count - 1);
+}
+
 void fp_blake3_hasher_init(FpBlake3Hasher *hasher) {
     memcpy(hasher->key_words, IV, sizeof(hasher->key_words));
     hasher->cv_stack_len = 0;
@@ -599,27 +1340,47 @@ void fp_blake3_hasher_init_keyed(FpBlake3Hasher *hasher, const uint8_t *key) {
     chunk_state_init(hasher, hasher->key_words, 0, KEYED_HASH);
 }
 
-void fp_blake3_hasher_init_derive_key(FpBlake3Hasher *hasher,
-                                      const char *context,
-                                      size_t context_len) {
+void fp_blake3_derive_key_context_init(FpBlake3DeriveKeyContext *ctx,
+                                       const char *context,
+                                       size_t context_len) {
     uint8_t context_key[FP_BLAKE3_KEY_LEN];
-    FpBlake3Hasher context_hasher;
-    fp_blake3_hasher_init(&context_hasher);
-    context_hasher.flags = DERIVE_KEY_CONTEXT;
-    chunk_state_init(&context_hasher,
-                     context_hasher.key_words,
-                     0,
-                     context_hasher.flags);
-    fp_blake3_hasher_update(&context_hasher,
-                            (const uint8_t *)context,
-                            context_len);
-    fp_blake3_hasher_finalize(&context_hasher, context_key);
-
-    key_words_from_bytes(context_key, hasher->key_words);
+    if (context_len <= FP_BLAKE3_CHUNK_LEN) {
+        output out = single_chunk_output(IV,
+                                         (const uint8_t *)context,
+                                         context_len,
+                                         DERIVE_KEY_CONTEXT);
+        output_root_bytes(&out, context_key, FP_BLAKE3_KEY_LEN);
+    } else {
+        FpBlake3Hasher context_hasher;
+        fp_blake3_hasher_init(&context_hasher);
+        context_hasher.flags = DERIVE_KEY_CONTEXT;
+        chunk_state_init(&context_hasher,
+                         context_hasher.key_words,
+                         0,
+                         context_hasher.flags);
+        fp_blake3_hasher_update(&context_hasher,
+                                (const uint8_t *)context,
+                                context_len);
+        fp_blake3_hasher_finalize(&context_hasher, context_key);
+    }
+    key_words_from_bytes(context_key, ctx->key_words);
+}
+
+void fp_blake3_hasher_init_derive_key_ctx(FpBlake3Hasher *hasher,
+                                          const FpBlake3DeriveKeyContext *ctx) {
+    memcpy(hasher->key_words, ctx->key_words, sizeof(hasher->key_words));
     hasher->cv_stack_len = 0;
     chunk_state_init(hasher, hasher->key_words, 0, DERIVE_KEY_MATERIAL);
 }
 
+void fp_blake3_hasher_init_derive_key(FpBlake3Hasher *hasher,
+                                      const char *context,
+                                      size_t context_len) {
+    FpBlake3DeriveKeyContext ctx;
+    fp_blake3_derive_key_context_init(&ctx, context, context_len);
+    fp_blake3_hasher_init_derive_key_ctx(hasher, &ctx);
+}
+
 void fp_blake3_hasher_update(FpBlake3Hasher *h,
                              const uint8_t *input,
                              size_t len) {
@@ -677,8 +1438,1044 @@ void fp_blake3_derive_key(const char *context,
                           const uint8_t *key_material,
                           size_t km_len,
                           uint8_t *output) {
+    FpBlake3DeriveKeyContext ctx;
+    fp_blake3_derive_key_context_init(&ctx, context, context_len);
+    fp_blake3_derive_key_ctx(&ctx, key_material, km_len, output);
+}
+
+void fp_blake3_derive_key_ctx(const FpBlake3DeriveKeyContext *ctx,
+                              const uint8_t *key_material,
+                              size_t km_len,
+                              uint8_t *output_bytes) {
+    if (km_len <= FP_BLAKE3_CHUNK_LEN) {
+        output out = single_chunk_output(ctx->key_words,
+                                         key_material,
+                                         km_len,
+                                         DERIVE_KEY_MATERIAL);
+        output_root_bytes(&out, output_bytes, FP_BLAKE3_OUT_LEN);
+        return;
+    }
     FpBlake3Hasher h;
-    fp_blake3_hasher_init_derive_key(&h, context, context_len);
+    fp_blake3_hasher_init_derive_key_ctx(&h, ctx);
     fp_blake3_hasher_update(&h, key_material, km_len);
-    fp_blake3_hasher_finalize(&h, output);
+    fp_blake3_hasher_finalize(&h, output_bytes);
+}
+
+#ifdef __AVX2__
+static void lane_blocks_rec(const uint8_t **blocks,
+                            const uint8_t *const *inputs,
+                            size_t offset,
+                            size_t lanes) {
+    if (lanes == 0) {
+        return;
+    }
+    blocks[0] = inputs[0] + offset;
+    lane_blocks_rec(blocks + 1, inputs + 1, offset, lanes - 1);
+}
+
+static void derive_lanes_blocks_rec(uint32_t (*cv)[8],
+                                    const uint8_t *const *key_material,
+                                    size_t lanes,
+                                    size_t block_idx,
+                                    size_t blocks,
+                                    uint32_t last_flags) {
+    if (block_idx == blocks) {
+        return;
+    }
+    static const uint64_t zero_counters[8] = {0};
+    const uint8_t *lane_blocks[8];
+    lane_blocks_rec(lane_blocks,
+                    key_material,
+                    block_idx * FP_BLAKE3_BLOCK_LEN,
+                    lanes);
+    uint32_t flags = DERIVE_KEY_MATERIAL;
+    if (block_idx == 0) {
+        flags |= CHUNK_START;
+    }
+    if (block_idx + 1 == blocks) {
+        flags |= last_flags;
+    }
+    compress_lanes(cv, lane_blocks, zero_counters, FP_BLAKE3_BLOCK_LEN, flags,
+                   lanes);
+    derive_lanes_blocks_rec(cv, key_material, lanes,
+                            block_idx + 1, blocks, last_flags);
+}
+
+static void store_cv_lanes_rec(uint8_t *out, uint32_t (*cv)[8], size_t lanes) {
+    if (lanes == 0) {
+        return;
+    }
+    store_cv_bytes_rec(out, cv[0], 8);
+    store_cv_lanes_rec(out + FP_BLAKE3_OUT_LEN, cv + 1, lanes - 1);
+}
+
+// Copies each lane's tail into a zero-padded block so the last compression
+// of short key material also runs on the lane kernels.
+static void derive_lanes_tail_rec(uint8_t (*tails)[FP_BLAKE3_BLOCK_LEN],
+                                  const uint8_t **lane_blocks,
+                                  const uint8_t *const *key_material,
+                                  size_t offset,
+                                  size_t tail_len,
+                                  size_t lanes) {
+    if (lanes == 0) {
+        return;
+    }
+    memset(tails[0], 0, FP_BLAKE3_BLOCK_LEN);
+    memcpy(tails[0], key_material[0] + offset, tail_len);
+    lane_blocks[0] = tails[0];
+    derive_lanes_tail_rec(tails + 1, lane_blocks + 1, key_material + 1,
+                          offset, tail_len, lanes - 1);
+}
+
+static int same_len_rec(const size_t *lens, size_t count, size_t len) {
+    if (count == 0) {
+        return 1;
+    }
+    return lens[0] == len && same_len_rec(lens + 1, count - 1, len);
+}
+
+static void derive_lanes(const FpBlake3DeriveKeyContext *ctx,
+                         const uint8_t *const *key_material,
+                         size_t km_len,
+                         size_t lanes,
+                         uint8_t *outputs) {
+    uint32_t cv[8][8];
+    size_t full_blocks = km_len / FP_BLAKE3_BLOCK_LEN;
+    size_t tail_len = km_len % FP_BLAKE3_BLOCK_LEN;
+    init_cv_lanes_rec(cv, lanes, ctx->key_words);
+    uint64_t t0 = STATS_BEGIN();
+    derive_lanes_blocks_rec(cv, key_material, lanes, 0, full_blocks,
+                            tail_len == 0 ? (CHUNK_END | ROOT) : 0);
+    if (tail_len != 0) {
+        static const uint64_t zero_counters[8] = {0};
+        uint8_t tails[8][FP_BLAKE3_BLOCK_LEN];
+        const uint8_t *lane_blocks[8];
+        derive_lanes_tail_rec(tails, lane_blocks, key_material,
+                              full_blocks * FP_BLAKE3_BLOCK_LEN, tail_len,
+                              lanes);
+        compress_lanes(cv, lane_blocks, zero_counters, (uint32_t)tail_len,
+                       DERIVE_KEY_MATERIAL | CHUNK_END | ROOT |
+                           (full_blocks == 0 ? CHUNK_START : 0),
+                       lanes);
+    }
+    if (lanes == 8) {
+        STATS_KERNEL(simd8, 8 * km_len, t0);
+    } else {
+        STATS_KERNEL(simd4, 4 * km_len, t0);
+    }
+    store_cv_lanes_rec(outputs, cv, lanes);
+}
+
+static size_t derive_lane_width(const size_t *km_lens, size_t count) {
+    if (!have_avx2() || km_lens[0] == 0 ||
+        km_lens[0] > FP_BLAKE3_CHUNK_LEN) {
+        return 1;
+    }
+    if (count >= 8 &&
+        dispatch_cfg.simd8_min_chunks != FP_BLAKE3_DISPATCH_OFF &&
+        same_len_rec(km_lens, 8, km_lens[0])) {
+        return 8;
+    }
+    if (count >= 4 &&
+        dispatch_cfg.simd4_min_chunks != FP_BLAKE3_DISPATCH_OFF &&
+        same_len_rec(km_lens, 4, km_lens[0])) {
+        return 4;
+    }
+    return 1;
+}
+#endif
+
+void fp_blake3_derive_keys(const FpBlake3DeriveKeyContext *ctx,
+                           const uint8_t *const *key_material,
+                           const size_t *km_lens,
+                           size_t count,
+                           uint8_t *outputs) {
+    if (count == 0) {
+        return;
+    }
+    size_t lanes = 1;
+#ifdef __AVX2__
+    lanes = derive_lane_width(km_lens, count);
+    if (lanes > 1) {
+        derive_lanes(ctx, key_material, km_lens[0], lanes, outputs);
+    }
+#endif
+    if (lanes == 1) {
+        fp_blake3_derive_key_ctx(ctx, key_material[0], km_lens[0], outputs);
+    }
+    fp_blake3_derive_keys(ctx,
+                          key_material + lanes,
+                          km_lens + lanes,
+                          count - lanes,
+                          outputs + lanes * FP_BLAKE3_OUT_LEN);
+}
+
+static void block64_scalar(const uint32_t key_words[8],
+                           uint32_t flags,
+                           const uint8_t *block,
+                           uint8_t *out) {
+    uint32_t block_words[16];
+    uint32_t out_words[16];
+    uint64_t t0 = STATS_BEGIN();
+    load_words(block_words, block);
+    compress(key_words, block_words, 0, FP_BLAKE3_BLOCK_LEN,
+             flags | CHUNK_START | CHUNK_END | ROOT, out_words);
+    STATS_KERNEL(scalar, FP_BLAKE3_BLOCK_LEN, t0);
+    store_cv_bytes_rec(out, out_words, 8);
+}
+
+#ifdef __AVX2__
+static void block64_lanes_rec(const uint8_t **lane_blocks,
+                              const uint8_t *blocks,
+                              size_t lane,
+                              size_t lanes,
+                              size_t active) {
+    if (lane == lanes) {
+        return;
+    }
+    lane_blocks[lane] = lane < active
+        ? blocks + lane * FP_BLAKE3_BLOCK_LEN
+        : zero_block;
+    block64_lanes_rec(lane_blocks, blocks, lane + 1, lanes, active);
+}
+
+static void block64_simd(const uint32_t key_words[8],
+                         uint32_t flags,
+                         const uint8_t *blocks,
+                         size_t lanes,
+                         size_t active,
+                         uint8_t *out) {
+    static const uint64_t zero_counters[8] = {0};
+    uint32_t cv[8][8];
+    const uint8_t *lane_blocks[8];
+    init_cv_lanes_rec(cv, lanes, key_words);
+    block64_lanes_rec(lane_blocks, blocks, 0, lanes, active);
+    uint64_t t0 = STATS_BEGIN();
+    compress_lanes(cv, lane_blocks, zero_counters, FP_BLAKE3_BLOCK_LEN,
+                   flags | CHUNK_START | CHUNK_END | ROOT, lanes);
+    if (lanes == 8) {
+        STATS_KERNEL(simd8, active * FP_BLAKE3_BLOCK_LEN, t0);
+    } else {
+        STATS_KERNEL(simd4, active * FP_BLAKE3_BLOCK_LEN, t0);
+    }
+    store_cv_lanes_rec(out, cv, active);
+}
+#endif
+
+// Each block is a whole one-block input, so the chunk, end and root flags
+// are fixed and the CV words are the digest. Output never runs ahead of the
+// input it was read from, so out may alias blocks.
+static void hash_blocks64_rec(const uint32_t key_words[8],
+                              uint32_t flags,
+                              const uint8_t *blocks,
+                              size_t count,
+                              uint8_t *out) {
+    if (count == 0) {
+        return;
+    }
+    size_t done = 1;
+#ifdef __AVX2__
+    size_t active8 = count < 8 ? count : 8;
+    size_t active4 = count < 4 ? count : 4;
+    if (have_avx2() && active8 >= dispatch_cfg.simd8_min_chunks) {
+        block64_simd(key_words, flags, blocks, 8, active8, out);
+        done = active8;
+    } else if (have_avx2() && active4 >= dispatch_cfg.simd4_min_chunks) {
+        block64_simd(key_words, flags, blocks, 4, active4, out);
+        done = active4;
+    } else {
+        block64_scalar(key_words, flags, blocks, out);
+    }
+#else
+    block64_scalar(key_words, flags, blocks, out);
+#endif
+    hash_blocks64_rec(key_words,
+                      flags,
+                      blocks + done * FP_BLAKE3_BLOCK_LEN,
+                      count - done,
+                      out + done * FP_BLAKE3_OUT_LEN);
+}
+
+void fp_blake3_hash_blocks64(const uint8_t *key,
+                             const uint8_t *blocks,
+                             size_t count,
+                             uint8_t *out) {
+    uint32_t key_words[8];
+    if (key) {
+        key_words_from_bytes(key, key_words);
+        hash_blocks64_rec(key_words, KEYED_HASH, blocks, count, out);
+        return;
+    }
+    hash_blocks64_rec(IV, 0, blocks, count, out);
+}
+
+size_t fp_blake3_merkle_level(const uint8_t *key,
+                              const uint8_t *nodes,
+                              size_t count,
+                              uint8_t *out) {
+    size_t parents = count / 2;
+    fp_blake3_hash_blocks64(key, nodes, parents, out);
+    if ((count & 1) == 0) {
+        return parents;
+    }
+    memmove(out + parents * FP_BLAKE3_OUT_LEN,
+            nodes + (count - 1) * FP_BLAKE3_OUT_LEN,
+            FP_BLAKE3_OUT_LEN);
+    return parents + 1;
+}
+
+static void merkle_root_rec(const uint8_t *key, uint8_t *nodes, size_t count) {
+    if (count <= 1) {
+        return;
+    }
+    merkle_root_rec(key, nodes, fp_blake3_merkle_level(key, nodes, count, nodes));
+}
+
+void fp_blake3_merkle_root(const uint8_t *key,
+                           uint8_t *nodes,
+                           size_t count,
+                           uint8_t *root) {
+    if (count == 0) {
+        if (key) {
+            fp_blake3_hash_keyed(key, NULL, 0, root);
+        } else {
+            fp_blake3_hash(NULL, 0, root);
+        }
+        return;
+    }
+    merkle_root_rec(key, nodes, count);
+    memmove(root, nodes, FP_BLAKE3_OUT_LEN);
+}
+
+enum {
+    STREAM_MAX_CVS = 54,
+    STREAM_SPILL_CVS = STREAM_MAX_CVS - FP_BLAKE3_STREAM_INLINE_CVS,
+    STREAM_SPILL_FIRST = 4,
+    STREAM_WINDOW = 64,
+    CHUNK_BLOCKS = FP_BLAKE3_CHUNK_LEN / FP_BLAKE3_BLOCK_LEN,
+};
+
+typedef struct {
+    FpBlake3Stream *stream;
+    FpBlake3StreamWrite *write;
+    const uint8_t *block;
+} stream_job;
+
+static void stream_set_init_words(FpBlake3StreamSet *set,
+                                  const uint32_t key_words[8],
+                                  uint32_t flags) {
+    memcpy(set->key_words, key_words, sizeof(set->key_words));
+    set->flags = flags;
+}
+
+void fp_blake3_stream_set_init(FpBlake3StreamSet *set) {
+    stream_set_init_words(set, IV, 0);
+}
+
+void fp_blake3_stream_set_init_keyed(FpBlake3StreamSet *set,
+                                     const uint8_t *key) {
+    uint32_t key_words[8];
+    key_words_from_bytes(key, key_words);
+    stream_set_init_words(set, key_words, KEYED_HASH);
+}
+
+void fp_blake3_stream_set_init_derive_key_ctx(
+    FpBlake3StreamSet *set,
+    const FpBlake3DeriveKeyContext *ctx) {
+    stream_set_init_words(set, ctx->key_words, DERIVE_KEY_MATERIAL);
+}
+
+static void stream_chunk_init(const FpBlake3StreamSet *set,
+                              FpBlake3Stream *st,
+                              uint64_t chunk_counter) {
+    memcpy(st->cv, set->key_words, sizeof(st->cv));
+    st->chunk_counter = chunk_counter;
+    st->block_len = 0;
+    st->blocks_compressed = 0;
+}
+
+void fp_blake3_stream_init(const FpBlake3StreamSet *set,
+                           FpBlake3Stream *stream) {
+    stream_chunk_init(set, stream, 0);
+    stream->cv_stack_len = 0;
+    stream->cv_spill_cap = 0;
+    stream->cv_spill = NULL;
+}
+
+void fp_blake3_stream_reset(const FpBlake3StreamSet *set,
+                            FpBlake3Stream *stream) {
+    stream_chunk_init(set, stream, 0);
+    stream->cv_stack_len = 0;
+}
+
+void fp_blake3_stream_release(FpBlake3Stream *stream) {
+    free(stream->cv_spill);
+    stream->cv_spill = NULL;
+    stream->cv_spill_cap = 0;
+    stream->cv_stack_len = 0;
+}
+
+static const uint32_t *stream_slot(const FpBlake3Stream *st, size_t idx) {
+    if (idx < FP_BLAKE3_STREAM_INLINE_CVS) {
+        return st->cv_stack[idx];
+    }
+    return st->cv_spill[idx - FP_BLAKE3_STREAM_INLINE_CVS];
+}
+
+static uint32_t *stream_slot_mut(FpBlake3Stream *st, size_t idx) {
+    if (idx < FP_BLAKE3_STREAM_INLINE_CVS) {
+        return st->cv_stack[idx];
+    }
+    return st->cv_spill[idx - FP_BLAKE3_STREAM_INLINE_CVS];
+}
+
+static size_t bit_count_rec(uint64_t x) {
+    return x == 0 ? 0 : 1 + bit_count_rec(x & (x - 1));
+}
+
+// Sets the lowest clear bits of x while it stays <= last, which leaves the
+// value in [x, last] with the most bits set.
+static uint64_t most_bits_rec(uint64_t x, uint64_t last, unsigned bit) {
+    if (bit == 64) {
+        return x;
+    }
+    uint64_t y = x | ((uint64_t)1 << bit);
+    return most_bits_rec(y <= last ? y : x, last, bit + 1);
+}
+
+// The CV stack holds one entry per set bit of the chunk count, so the
+// deepest it gets while the count runs from first to last is the largest
+// popcount in that range.
+static size_t stream_depth(uint64_t first, uint64_t last) {
+    return bit_count_rec(most_bits_rec(first, last, 0));
+}
+
+static int stream_reserve(FpBlake3Stream *st, size_t depth) {
+    if (depth <= FP_BLAKE3_STREAM_INLINE_CVS + (size_t)st->cv_spill_cap) {
+        return 0;
+    }
+    size_t need = depth - FP_BLAKE3_STREAM_INLINE_CVS;
+    size_t cap = st->cv_spill_cap ? 2 * (size_t)st->cv_spill_cap
+                                  : STREAM_SPILL_FIRST;
+    if (cap < need) {
+        cap = need;
+    }
+    if (cap > STREAM_SPILL_CVS) {
+        cap = STREAM_SPILL_CVS;
+    }
+    uint32_t (*spill)[8] = (uint32_t (*)[8])realloc(st->cv_spill,
+                                                    cap * sizeof(spill[0]));
+    if (!spill) {
+        return -1;
+    }
+    st->cv_spill = spill;
+    st->cv_spill_cap = (uint8_t)cap;
+    return 0;
+}
+
+static void stream_add_chunk_cv(const FpBlake3StreamSet *set,
+                                FpBlake3Stream *st,
+                                uint32_t new_cv[8],
+                                uint64_t total_chunks) {
+    if ((total_chunks & 1) != 0) {
+        memcpy(stream_slot_mut(st, st->cv_stack_len), new_cv,
+               sizeof(st->cv_stack[0]));
+        st->cv_stack_len++;
+        return;
+    }
+    st->cv_stack_len--;
+    output parent = parent_output(stream_slot(st, st->cv_stack_len),
+                                  new_cv,
+                                  set->key_words,
+                                  set->flags);
+    output_chaining_value(&parent, new_cv);
+    stream_add_chunk_cv(set, st, new_cv, total_chunks >> 1);
+}
+
+static void stream_add_chunk_cvs_rec(const FpBlake3StreamSet *set,
+                                     FpBlake3Stream *st,
+                                     uint32_t (*cvs)[8],
+                                     size_t count) {
+    if (count == 0) {
+        return;
+    }
+    uint64_t total_chunks = st->chunk_counter + 1;
+    stream_add_chunk_cv(set, st, cvs[0], total_chunks);
+    st->chunk_counter = total_chunks;
+    stream_add_chunk_cvs_rec(set, st, cvs + 1, count - 1);
+}
+
+static int stream_bulk(const FpBlake3StreamSet *set,
+                       FpBlake3Stream *st,
+                       FpBlake3StreamWrite *w) {
+    size_t full_chunks = (w->len - 1) / FP_BLAKE3_CHUNK_LEN;
+    if (full_chunks > dispatch_cfg.batch_chunks) {
+        full_chunks = dispatch_cfg.batch_chunks;
+    }
+    size_t depth = stream_depth(st->chunk_counter + 1,
+                                st->chunk_counter + full_chunks);
+    if (stream_reserve(st, depth) != 0) {
+        return -1;
+    }
+    uint32_t cvs[FP_BLAKE3_MAX_BATCH_CHUNKS][8];
+    chunk_cvs(w->input, full_chunks, set->key_words, st->chunk_counter,
+              set->flags, cvs);
+    stream_add_chunk_cvs_rec(set, st, cvs, full_chunks);
+    stream_chunk_init(set, st, st->chunk_counter);
+    w->input += full_chunks * FP_BLAKE3_CHUNK_LEN;
+    w->len -= full_chunks * FP_BLAKE3_CHUNK_LEN;
+    return 0;
+}
+
+static const uint8_t *stream_prepare(const FpBlake3StreamSet *set,
+                                     FpBlake3Stream *st,
+                                     FpBlake3StreamWrite *w,
+                                     int *err) {
+    if (w->len == 0) {
+        return NULL;
+    }
+    if (st->blocks_compressed == 0 && st->block_len == 0 &&
+        w->len > FP_BLAKE3_CHUNK_LEN) {
+        if (stream_bulk(set, st, w) != 0) {
+            *err = -1;
+            return NULL;
+        }
+        return stream_prepare(set, st, w, err);
+    }
+    if (st->blocks_compressed + 1 == CHUNK_BLOCKS &&
+        stream_reserve(st, bit_count_rec(st->chunk_counter + 1)) != 0) {
+        *err = -1;
+        return NULL;
+    }
+    if (st->block_len == FP_BLAKE3_BLOCK_LEN) {
+        return st->block;
+    }
+    if (st->block_len == 0 && w->len > FP_BLAKE3_BLOCK_LEN) {
+        return w->input;
+    }
+    size_t want = FP_BLAKE3_BLOCK_LEN - st->block_len;
+    if (want > w->len) {
+        want = w->len;
+    }
+    memcpy(st->block + st->block_len, w->input, want);
+    st->block_len += (uint8_t)want;
+    w->input += want;
+    w->len -= want;
+    return stream_prepare(set, st, w, err);
+}
+
+static uint32_t stream_block_flags(const FpBlake3StreamSet *set,
+                                   const FpBlake3Stream *st) {
+    return block_flags_for_index(set->flags, st->blocks_compressed);
+}
+
+static void stream_finish_block(const FpBlake3StreamSet *set,
+                                stream_job *job) {
+    FpBlake3Stream *st = job->stream;
+    if (job->block == st->block) {
+        st->block_len = 0;
+    } else {
+        job->write->input += FP_BLAKE3_BLOCK_LEN;
+        job->write->len -= FP_BLAKE3_BLOCK_LEN;
+    }
+    st->blocks_compressed++;
+    if (st->blocks_compressed == CHUNK_BLOCKS) {
+        uint32_t chunk_cv[8];
+        memcpy(chunk_cv, st->cv, sizeof(chunk_cv));
+        uint64_t total_chunks = st->chunk_counter + 1;
+        stream_add_chunk_cv(set, st, chunk_cv, total_chunks);
+        stream_chunk_init(set, st, total_chunks);
+    }
+}
+
+static void stream_jobs_scalar_rec(const FpBlake3StreamSet *set,
+                                   stream_job *jobs,
+                                   size_t count) {
+    if (count == 0) {
+        return;
+    }
+    FpBlake3Stream *st = jobs[0].stream;
+    uint32_t block_words[16];
+    uint64_t t0 = STATS_BEGIN();
+    load_words(block_words, jobs[0].block);
+    compress_cv(st->cv, block_words, st->chunk_counter,
+                FP_BLAKE3_BLOCK_LEN, stream_block_flags(set, st));
+    STATS_KERNEL(scalar, FP_BLAKE3_BLOCK_LEN, t0);
+    stream_finish_block(set, &jobs[0]);
+    stream_jobs_scalar_rec(set, jobs + 1, count - 1);
+}
+
+#ifdef __AVX2__
+static void stream_lanes_load_rec(const stream_job *jobs,
+                                  size_t lanes,
+                                  uint32_t (*cv)[8],
+                                  const uint8_t **blocks,
+                                  uint64_t *counters) {
+    if (lanes == 0) {
+        return;
+    }
+    memcpy(cv[0], jobs[0].stream->cv, sizeof(cv[0]));
+    blocks[0] = jobs[0].block;
+    counters[0] = jobs[0].stream->chunk_counter;
+    stream_lanes_load_rec(jobs + 1, lanes - 1, cv + 1, blocks + 1,
+                          counters + 1);
+}
+
+static void stream_lanes_store_rec(const FpBlake3StreamSet *set,
+                                   stream_job *jobs,
+                                   size_t lanes,
+                                   uint32_t (*cv)[8]) {
+    if (lanes == 0) {
+        return;
+    }
+    memcpy(jobs[0].stream->cv, cv[0], sizeof(cv[0]));
+    stream_finish_block(set, &jobs[0]);
+    stream_lanes_store_rec(set, jobs + 1, lanes - 1, cv + 1);
+}
+
+static void stream_jobs_lanes(const FpBlake3StreamSet *set,
+                              stream_job *jobs,
+                              size_t lanes) {
+    uint32_t cv[8][8];
+    const uint8_t *blocks[8];
+    uint64_t counters[8];
+    uint32_t flags = stream_block_flags(set, jobs[0].stream);
+    stream_lanes_load_rec(jobs, lanes, cv, blocks, counters);
+    uint64_t t0 = STATS_BEGIN();
+    compress_lanes(cv, blocks, counters, FP_BLAKE3_BLOCK_LEN, flags, lanes);
+    if (lanes == 8) {
+        STATS_KERNEL(simd8, 8 * FP_BLAKE3_BLOCK_LEN, t0);
+    } else {
+        STATS_KERNEL(simd4, 4 * FP_BLAKE3_BLOCK_LEN, t0);
+    }
+    stream_lanes_store_rec(set, jobs, lanes, cv);
+}
+#endif
+
+static void stream_jobs_rec(const FpBlake3StreamSet *set,
+                            stream_job *jobs,
+                            size_t count) {
+    if (count == 0) {
+        return;
+    }
+#ifdef __AVX2__
+    if (have_avx2()) {
+        if (count >= 8 &&
+            dispatch_cfg.simd8_min_chunks != FP_BLAKE3_DISPATCH_OFF) {
+            stream_jobs_lanes(set, jobs, 8);
+            stream_jobs_rec(set, jobs + 8, count - 8);
+            return;
+        }
+        if (count >= 4 &&
+            dispatch_cfg.simd4_min_chunks != FP_BLAKE3_DISPATCH_OFF) {
+            stream_jobs_lanes(set, jobs, 4);
+            stream_jobs_rec(set, jobs + 4, count - 4);
+            return;
+        }
+    }
+#endif
+    stream_jobs_scalar_rec(set, jobs, count);
+}
+
+static int stream_gather_rec(const FpBlake3StreamSet *set,
+                             FpBlake3StreamWrite *writes,
+                             size_t count,
+                             stream_job *jobs,
+                             size_t *class_counts) {
+    if (count == 0) {
+        return 0;
+    }
+    int err = 0;
+    FpBlake3Stream *st = writes[0].stream;
+    const uint8_t *block = stream_prepare(set, st, &writes[0], &err);
+    if (err != 0) {
+        return err;
+    }
+    if (block) {
+        size_t cls = st->blocks_compressed == 0
+            ? 0
+            : (st->blocks_compressed + 1 == CHUNK_BLOCKS ? 2 : 1);
+        stream_job *slot = jobs + cls * STREAM_WINDOW + class_counts[cls];
+        slot->stream = st;
+        slot->write = &writes[0];
+        slot->block = block;
+        class_counts[cls]++;
+    }
+    return stream_gather_rec(set, writes + 1, count - 1, jobs, class_counts);
+}
+
+static int stream_rounds_rec(const FpBlake3StreamSet *set,
+                             FpBlake3StreamWrite *writes,
+                             size_t count) {
+    stream_job jobs[3 * STREAM_WINDOW];
+    size_t class_counts[3] = {0, 0, 0};
+    int err = stream_gather_rec(set, writes, count, jobs, class_counts);
+    if (err != 0) {
+        return err;
+    }
+    if (class_counts[0] + class_counts[1] + class_counts[2] == 0) {
+        return 0;
+    }
+    stream_jobs_rec(set, jobs, class_counts[0]);
+    stream_jobs_rec(set, jobs + STREAM_WINDOW, class_counts[1]);
+    stream_jobs_rec(set, jobs + 2 * STREAM_WINDOW, class_counts[2]);
+    return stream_rounds_rec(set, writes, count);
+}
+
+int fp_blake3_stream_set_update(const FpBlake3StreamSet *set,
+                                FpBlake3StreamWrite *writes,
+                                size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t window = count > STREAM_WINDOW ? STREAM_WINDOW : count;
+    int err = stream_rounds_rec(set, writes, window);
+    if (err != 0) {
+        return err;
+    }
+    return fp_blake3_stream_set_update(set, writes + window, count - window);
+}
+
+int fp_blake3_stream_update(const FpBlake3StreamSet *set,
+                            FpBlake3Stream *stream,
+                            const uint8_t *input,
+                            size_t len) {
+    FpBlake3StreamWrite write = {stream, input, len};
+    return fp_blake3_stream_set_update(set, &write, 1);
+}
+
+static output stream_reduce_rec(const FpBlake3StreamSet *set,
+                                const FpBlake3Stream *st,
+                                output out,
+                                size_t idx) {
+    if (idx == 0) {
+        return out;
+    }
+    uint32_t cv[8];
+    output_chaining_value(&out, cv);
+    output next = parent_output(stream_slot(st, idx - 1),
+                                cv,
+                                set->key_words,
+                                set->flags);
+    return stream_reduce_rec(set, st, next, idx - 1);
+}
+
+void fp_blake3_stream_finalize(const FpBlake3StreamSet *set,
+                               const FpBlake3Stream *stream,
+                               uint8_t *output_bytes,
+                               size_t output_len) {
+    output out;
+    uint8_t block[FP_BLAKE3_BLOCK_LEN] = {0};
+    memcpy(block, stream->block, stream->block_len);
+    load_words(out.block_words, block);
+    memcpy(out.input_cv, stream->cv, sizeof(out.input_cv));
+    out.counter = stream->chunk_counter;
+    out.block_len = stream->block_len;
+    out.flags = set->flags | CHUNK_END |
+        (stream->blocks_compressed == 0 ? CHUNK_START : 0);
+    out = stream_reduce_rec(set, stream, out, stream->cv_stack_len);
+    output_root_bytes(&out, output_bytes, output_len);
+}
+
+void fp_blake3_subtree_cv(const FpBlake3StreamSet *mode,
+                          const uint8_t *input,
+                          size_t len,
+                          uint64_t chunk_counter,
+                          uint32_t cv[8]) {
+    FpBlake3Hasher h;
+    memcpy(h.key_words, mode->key_words, sizeof(h.key_words));
+    h.cv_stack_len = 0;
+    chunk_state_init(&h, h.key_words, chunk_counter, mode->flags);
+    fp_blake3_hasher_update_rec(&h, input, len);
+    output out = chunk_state_output(&h);
+    out = reduce_stack_rec(&h, out, h.cv_stack_len);
+    output_chaining_value(&out, cv);
+}
+
+void fp_blake3_parent_cv(const FpBlake3StreamSet *mode,
+                         const uint32_t left[8],
+                         const uint32_t right[8],
+                         uint32_t cv[8]) {
+    output out = parent_output(left, right, mode->key_words, mode->flags);
+    output_chaining_value(&out, cv);
+}
+
+void fp_blake3_parent_root(const FpBlake3StreamSet *mode,
+                           const uint32_t left[8],
+                           const uint32_t right[8],
+                           uint8_t *output_bytes,
+                           size_t output_len) {
+    output out = parent_output(left, right, mode->key_words, mode->flags);
+    output_root_bytes(&out, output_bytes, output_len);
+}
+
+int fp_blake3_stats_enabled(void) {
+#ifdef FP_BLAKE3_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void fp_blake3_stats_snapshot(FpBlake3Stats *out) {
+#ifdef FP_BLAKE3_STATS
+    *out = tls_stats;
+#else
+    memset(out, 0, sizeof(*out));
+#endif
+}
+
+void fp_blake3_stats_reset(void) {
+#ifdef FP_BLAKE3_STATS
+    memset(&tls_stats, 0, sizeof(tls_stats));
+#endif
+}
+
+static uint32_t clamp_u32(uint32_t v, uint32_t lo, uint32_t hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static FpBlake3Dispatch dispatch_normalize(const FpBlake3Dispatch *cfg) {
+    FpBlake3Dispatch out;
+    out.simd4_min_chunks = clamp_u32(cfg->simd4_min_chunks,
+                                     2,
+                                     FP_BLAKE3_DISPATCH_OFF);
+    out.simd8_min_chunks = clamp_u32(cfg->simd8_min_chunks,
+                                     5,
+                                     FP_BLAKE3_DISPATCH_OFF);
+    out.batch_chunks = clamp_u32(cfg->batch_chunks,
+                                 1,
+                                 FP_BLAKE3_MAX_BATCH_CHUNKS);
+    out.prefetch_bytes = clamp_u32(cfg->prefetch_bytes,
+                                   0,
+                                   FP_BLAKE3_MAX_PREFETCH_BYTES) & ~63u;
+    return out;
+}
+
+void fp_blake3_dispatch_defaults(FpBlake3Dispatch *cfg) {
+    *cfg = DISPATCH_DEFAULTS;
+}
+
+void fp_blake3_dispatch_get(FpBlake3Dispatch *cfg) {
+    *cfg = dispatch_cfg;
+}
+
+void fp_blake3_dispatch_set(const FpBlake3Dispatch *cfg) {
+    dispatch_cfg = dispatch_normalize(cfg);
+}
+
+int fp_blake3_kernels_set(FpBlake3Kernels kernels) {
+#ifdef FP_BLAKE3_NO_ASM
+    if (kernels != FP_BLAKE3_KERNELS_C) {
+        return -1;
+    }
+#else
+    if (kernels != FP_BLAKE3_KERNELS_C && kernels != FP_BLAKE3_KERNELS_ASM) {
+        return -1;
+    }
+#endif
+    kernel_set = kernels;
+    return 0;
+}
+
+FpBlake3Kernels fp_blake3_kernels_get(void) {
+    return kernel_set;
+}
+
+#ifdef __AVX2__
+typedef void (*chunk_cvs_fn)(const uint8_t *input,
+                             size_t chunks,
+                             const uint32_t key_words[8],
+                             uint64_t counter,
+                             uint32_t flags,
+                             uint32_t out[][8]);
+
+enum { TUNE_TRIALS = 32, TUNE_CHUNKS = 64 };
+
+static uint64_t tune_kernel_rec(chunk_cvs_fn fn,
+                                const uint8_t *input,
+                                size_t chunks,
+                                size_t trials,
+                                uint64_t best) {
+    if (trials == 0) {
+        return best;
+    }
+    uint32_t out[8][8];
+    uint64_t t0 = __rdtsc();
+    fn(input, chunks, IV, 0, 0, out);
+    uint64_t dt = __rdtsc() - t0;
+    return tune_kernel_rec(fn, input, chunks, trials - 1,
+                           dt < best ? dt : best);
+}
+
+static uint64_t tune_batch_cost_rec(const FpBlake3Dispatch *cfg,
+                                    const uint8_t *input,
+                                    size_t trials,
+                                    uint64_t best) {
+    if (trials == 0) {
+        return best;
+    }
+    FpBlake3Hasher h;
+    fp_blake3_hasher_init(&h);
+    uint64_t t0 = __rdtsc();
+    process_chunks_rec(cfg, &h, input, TUNE_CHUNKS, 0, 0);
+    uint64_t dt = __rdtsc() - t0;
+    return tune_batch_cost_rec(cfg, input, trials - 1,
+                               dt < best ? dt : best);
+}
+
+// Times the hasher's chunk loop with the tuned crossovers in cfg; the
+// process-wide config is left alone until tuning is done.
+static uint32_t tune_batch_rec(FpBlake3Dispatch *cfg,
+                               const uint8_t *input,
+                               uint32_t batch,
+                               uint32_t best_batch,
+                               uint64_t best) {
+    if (batch > FP_BLAKE3_MAX_BATCH_CHUNKS) {
+        return best_batch;
+    }
+    cfg->batch_chunks = batch;
+    uint64_t dt = tune_batch_cost_rec(cfg, input, TUNE_TRIALS / 4,
+                                      UINT64_MAX);
+    if (dt < best) {
+        return tune_batch_rec(cfg, input, batch * 2, batch, dt);
+    }
+    return tune_batch_rec(cfg, input, batch * 2, best_batch, best);
+}
+
+// Costs below are in eighths of a cycle so that scalar8 / 8 (one scalar
+// chunk) stays integral. A masked pass costs the same as a full one.
+static uint32_t tune_simd4_min_rec(uint32_t lanes,
+                                   uint64_t simd4,
+                                   uint64_t scalar8) {
+    if (lanes > 4) {
+        return FP_BLAKE3_DISPATCH_OFF;
+    }
+    if (8 * simd4 < lanes * scalar8) {
+        return lanes;
+    }
+    return tune_simd4_min_rec(lanes + 1, simd4, scalar8);
+}
+
+static uint64_t tune_cost_without8_rec(uint64_t lanes,
+                                       uint32_t simd4_min,
+                                       uint64_t simd4,
+                                       uint64_t scalar8) {
+    if (lanes == 0) {
+        return 0;
+    }
+    if (lanes < simd4_min) {
+        return lanes * scalar8;
+    }
+    uint64_t take = lanes < 4 ? lanes : 4;
+    return 8 * simd4 +
+        tune_cost_without8_rec(lanes - take, simd4_min, simd4, scalar8);
+}
+
+static uint32_t tune_simd8_min_rec(uint32_t lanes,
+                                   uint32_t simd4_min,
+                                   uint64_t simd4,
+                                   uint64_t simd8,
+                                   uint64_t scalar8) {
+    if (lanes > 8) {
+        return FP_BLAKE3_DISPATCH_OFF;
+    }
+    if (8 * simd8 <
+        tune_cost_without8_rec(lanes, simd4_min, simd4, scalar8)) {
+        return lanes;
+    }
+    return tune_simd8_min_rec(lanes + 1, simd4_min, simd4, simd8, scalar8);
+}
+
+static FpBlake3Dispatch autotune_avx2(void) {
+    FpBlake3Dispatch cfg = DISPATCH_DEFAULTS;
+    size_t len = TUNE_CHUNKS * FP_BLAKE3_CHUNK_LEN + 1;
+    uint8_t *input = (uint8_t *)malloc(len);
+    if (!input) {
+        return cfg;
+    }
+    memset(input, 0xa5, len);
+
+    uint64_t scalar8 =
+        tune_kernel_rec(chunk_cvs_scalar, input, 8, TUNE_TRIALS, UINT64_MAX);
+    uint64_t simd4 =
+        tune_kernel_rec(chunk_cvs_simd4, input, 4, TUNE_TRIALS, UINT64_MAX);
+    uint64_t simd8 =
+        tune_kernel_rec(chunk_cvs_simd8, input, 8, TUNE_TRIALS, UINT64_MAX);
+
+    cfg.simd4_min_chunks = tune_simd4_min_rec(2, simd4, scalar8);
+    cfg.simd8_min_chunks = tune_simd8_min_rec(5,
+                                              cfg.simd4_min_chunks,
+                                              simd4,
+                                              simd8,
+                                              scalar8);
+
+    cfg.batch_chunks = tune_batch_rec(&cfg, input, 8, 8, UINT64_MAX);
+    free(input);
+    return cfg;
+}
+#endif
+
+void fp_blake3_autotune(FpBlake3Dispatch *cfg) {
+    FpBlake3Dispatch tuned = DISPATCH_DEFAULTS;
+    uint32_t prefetch_bytes = dispatch_cfg.prefetch_bytes;
+#ifdef __AVX2__
+    if (have_avx2()) {
+        tuned = autotune_avx2();
+    }
+#endif
+    // The tuning buffer stays in cache, so the prefetch distance is kept.
+    tuned.prefetch_bytes = prefetch_bytes;
+    dispatch_cfg = dispatch_normalize(&tuned);
+    if (cfg) {
+        *cfg = dispatch_cfg;
+    }
+}
+
+// v1 files predate prefetch_bytes; each version must have all its fields.
+int fp_blake3_dispatch_load(const char *path, FpBlake3Dispatch *cfg) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    FpBlake3Dispatch loaded = DISPATCH_DEFAULTS;
+    unsigned version = 0;
+    int n = fscanf(f,
+                   " fp_blake3_dispatch v%u"
+                   " simd4_min_chunks=%u"
+                   " simd8_min_chunks=%u"
+                   " batch_chunks=%u"
+                   " prefetch_bytes=%u",
+                   &version,
+                   &loaded.simd4_min_chunks,
+                   &loaded.simd8_min_chunks,
+                   &loaded.batch_chunks,
+                   &loaded.prefetch_bytes);
+    fclose(f);
+    if (!((version == 1 && n == 4) || (version == 2 && n == 5))) {
+        return -1;
+    }
+    *cfg = dispatch_normalize(&loaded);
+    return 0;
+}
+
+int fp_blake3_dispatch_save(const char *path, const FpBlake3Dispatch *cfg) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return -1;
+    }
+    int n = fprintf(f,
+                    "fp_blake3_dispatch v2\n"
+                    "simd4_min_chunks=%u\n"
+                    "simd8_min_chunks=%u\n"
+                    "batch_chunks=%u\n"
+                    "prefetch_bytes=%u\n",
+                    cfg->simd4_min_chunks,
+                    cfg->simd8_min_chunks,
+                    cfg->batch_chunks,
+                    cfg->prefetch_bytes);
+    if (fclose(f) != 0 || n < 0) {
+        return -1;
+    }
+    return 0;
 }
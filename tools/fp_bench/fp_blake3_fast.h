@@ -8,6 +8,15 @@
 #define FP_BLAKE3_BLOCK_LEN 64
 #define FP_BLAKE3_CHUNK_LEN 1024
 
+#define FP_BLAKE3_MAX_BATCH_CHUNKS 32
+#define FP_BLAKE3_STREAM_INLINE_CVS 2
+#define FP_BLAKE3_DISPATCH_OFF     UINT32_MAX
+#define FP_BLAKE3_MAX_PREFETCH_BYTES (64 * 1024)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct {
     uint32_t cv[8];
     uint64_t chunk_counter;
@@ -22,11 +31,90 @@ typedef struct {
     uint8_t _pad[3];
 } FpBlake3Hasher;
 
+// Per-thread hot-path counters. Only populated when the library is built
+// with -DFP_BLAKE3_STATS; otherwise snapshots are all zero.
+typedef struct {
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t cycles;
+} FpBlake3KernelStats;
+
+typedef struct {
+    FpBlake3KernelStats scalar;
+    FpBlake3KernelStats simd4;
+    FpBlake3KernelStats simd8;
+    FpBlake3KernelStats partial;
+    // Non-root parents; the root compression is counted under xof.
+    uint64_t parent_compressions;
+    uint64_t xof_compressions;
+    uint64_t xof_bytes;
+} FpBlake3Stats;
+
+// Size crossovers used by the chunk dispatcher. simd8_min_chunks and
+// simd4_min_chunks are the smallest remaining chunk counts sent to the 8-way
+// and 4-way kernels, with unused lanes masked off (FP_BLAKE3_DISPATCH_OFF
+// disables a tier); batch_chunks is how many chunks the hasher hands to the
+// dispatcher at once. prefetch_bytes is how far ahead of each 8-way pass
+// the chunk loop issues software prefetches (0 leaves it to the hardware);
+// it mostly helps when the input is on a remote NUMA node.
+typedef struct {
+    uint32_t simd4_min_chunks;
+    uint32_t simd8_min_chunks;
+    uint32_t batch_chunks;
+    uint32_t prefetch_bytes;
+} FpBlake3Dispatch;
+
+// Compression kernel sets: the NASM objects, or the portable C/intrinsics
+// kernels that -DFP_BLAKE3_NO_ASM builds are limited to.
+typedef enum {
+    FP_BLAKE3_KERNELS_ASM,
+    FP_BLAKE3_KERNELS_C,
+} FpBlake3Kernels;
+
+// Precomputed key words for one derive_key context string. Reuse it to skip
+// rehashing the context for every derivation.
+typedef struct {
+    uint32_t key_words[8];
+} FpBlake3DeriveKeyContext;
+
+// Shared mode (key words and flags) for a group of compact streams.
+typedef struct {
+    uint32_t key_words[8];
+    uint32_t flags;
+} FpBlake3StreamSet;
+
+// Compact per-stream state (~184 bytes vs ~1.9 KB for FpBlake3Hasher).
+// The first FP_BLAKE3_STREAM_INLINE_CVS subtree CVs live inline; deeper
+// stacks spill to a heap block of cv_spill_cap CVs that grows with the
+// stack and that fp_blake3_stream_release() frees.
+typedef struct {
+    uint32_t cv[8];
+    uint64_t chunk_counter;
+    uint8_t block[FP_BLAKE3_BLOCK_LEN];
+    uint8_t block_len;
+    uint8_t blocks_compressed;
+    uint8_t cv_stack_len;
+    uint8_t cv_spill_cap;
+    uint32_t (*cv_spill)[8];
+    uint32_t cv_stack[FP_BLAKE3_STREAM_INLINE_CVS][8];
+} FpBlake3Stream;
+
+typedef struct {
+    FpBlake3Stream *stream;
+    const uint8_t *input;
+    size_t len;
+} FpBlake3StreamWrite;
+
 void fp_blake3_hasher_init(FpBlake3Hasher *hasher);
 void fp_blake3_hasher_init_keyed(FpBlake3Hasher *hasher, const uint8_t *key);
 void fp_blake3_hasher_init_derive_key(FpBlake3Hasher *hasher,
                                       const char *context,
                                       size_t context_len);
+void fp_blake3_derive_key_context_init(FpBlake3DeriveKeyContext *ctx,
+                                       const char *context,
+                                       size_t context_len);
+void fp_blake3_hasher_init_derive_key_ctx(FpBlake3Hasher *hasher,
+                                          const FpBlake3DeriveKeyContext *ctx);
 void fp_blake3_hasher_update(FpBlake3Hasher *hasher,
                              const uint8_t *input,
                              size_t len);
@@ -45,3 +133,107 @@ void fp_blake3_derive_key(const char *context,
                           const uint8_t *key_material,
                           size_t km_len,
                           uint8_t *output);
+void fp_blake3_derive_key_ctx(const FpBlake3DeriveKeyContext *ctx,
+                              const uint8_t *key_material,
+                              size_t km_len,
+                              uint8_t *output);
+// Derives count 32-byte keys into outputs (count * FP_BLAKE3_OUT_LEN bytes).
+// Runs of equal-length key material up to one chunk share SIMD lanes.
+void fp_blake3_derive_keys(const FpBlake3DeriveKeyContext *ctx,
+                           const uint8_t *const *key_material,
+                           const size_t *km_lens,
+                           size_t count,
+                           uint8_t *outputs);
+
+void fp_blake3_stream_set_init(FpBlake3StreamSet *set);
+void fp_blake3_stream_set_init_keyed(FpBlake3StreamSet *set,
+                                     const uint8_t *key);
+void fp_blake3_stream_set_init_derive_key_ctx(
+    FpBlake3StreamSet *set,
+    const FpBlake3DeriveKeyContext *ctx);
+void fp_blake3_stream_init(const FpBlake3StreamSet *set,
+                           FpBlake3Stream *stream);
+// Restarts a stream for a new input and keeps its spill block for reuse.
+void fp_blake3_stream_reset(const FpBlake3StreamSet *set,
+                            FpBlake3Stream *stream);
+void fp_blake3_stream_release(FpBlake3Stream *stream);
+// Feeds one pending write per stream and compresses ready blocks from all of
+// them together through the SIMD kernels. Each stream may appear at most
+// once per call; writes are consumed in place. Returns -1 if a CV stack
+// spill could not be allocated (the writes show how far each got).
+int fp_blake3_stream_set_update(const FpBlake3StreamSet *set,
+                                FpBlake3StreamWrite *writes,
+                                size_t count);
+int fp_blake3_stream_update(const FpBlake3StreamSet *set,
+                            FpBlake3Stream *stream,
+                            const uint8_t *input,
+                            size_t len);
+void fp_blake3_stream_finalize(const FpBlake3StreamSet *set,
+                               const FpBlake3Stream *stream,
+                               uint8_t *output,
+                               size_t output_len);
+
+// Building blocks for callers that hash subtrees on their own threads. The
+// subtree starting at chunk_counter must be a node of the full tree: it
+// holds at most 2^k chunks and chunk_counter is a multiple of 2^k. It must
+// also not be the whole input, whose root goes through the hasher instead.
+// Parents are combined left-balanced as in the hasher, and only the top
+// one is written with fp_blake3_parent_root.
+void fp_blake3_subtree_cv(const FpBlake3StreamSet *mode,
+                          const uint8_t *input,
+                          size_t len,
+                          uint64_t chunk_counter,
+                          uint32_t cv[8]);
+void fp_blake3_parent_cv(const FpBlake3StreamSet *mode,
+                         const uint32_t left[8],
+                         const uint32_t right[8],
+                         uint32_t cv[8]);
+void fp_blake3_parent_root(const FpBlake3StreamSet *mode,
+                           const uint32_t left[8],
+                           const uint32_t right[8],
+                           uint8_t *output,
+                           size_t output_len);
+
+// Hashes count independent 64-byte inputs (keyed when key is not NULL) into
+// count 32-byte digests, eight per SIMD pass. out may alias blocks, but
+// only for a single call: split into ranges on separate threads, a range
+// written in place overwrites blocks that an earlier range has yet to read.
+// fp_blake3_pool_merkle_level splits a level into a separate buffer.
+void fp_blake3_hash_blocks64(const uint8_t *key,
+                             const uint8_t *blocks,
+                             size_t count,
+                             uint8_t *out);
+// Builds one Merkle level: parent i is the digest of nodes 2i and 2i+1, and
+// an odd last node is carried up unchanged. out may alias nodes. Returns the
+// number of nodes written.
+size_t fp_blake3_merkle_level(const uint8_t *key,
+                              const uint8_t *nodes,
+                              size_t count,
+                              uint8_t *out);
+// Reduces count 32-byte nodes to the root level by level, in place.
+void fp_blake3_merkle_root(const uint8_t *key,
+                           uint8_t *nodes,
+                           size_t count,
+                           uint8_t *root);
+
+int fp_blake3_stats_enabled(void);
+void fp_blake3_stats_snapshot(FpBlake3Stats *out);
+void fp_blake3_stats_reset(void);
+
+// The dispatch config is process-wide; set it before hashing on other
+// threads. fp_blake3_autotune() benchmarks the kernels on this host,
+// applies the result and copies it to cfg when cfg is not NULL.
+void fp_blake3_dispatch_defaults(FpBlake3Dispatch *cfg);
+void fp_blake3_dispatch_get(FpBlake3Dispatch *cfg);
+void fp_blake3_dispatch_set(const FpBlake3Dispatch *cfg);
+void fp_blake3_autotune(FpBlake3Dispatch *cfg);
+int fp_blake3_dispatch_load(const char *path, FpBlake3Dispatch *cfg);
+int fp_blake3_dispatch_save(const char *path, const FpBlake3Dispatch *cfg);
+// Switches kernel sets under the same rules as the dispatch config. Returns
+// -1 if the set was not built in.
+int fp_blake3_kernels_set(FpBlake3Kernels kernels);
+FpBlake3Kernels fp_blake3_kernels_get(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,707 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "fp_blake3_file.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+enum {
+    FILE_ALIGN = 4096,
+    SLOT_FREE = 0,
+    SLOT_READING = 1,
+    SLOT_READY = 2,
+};
+
+#ifdef _WIN32
+typedef HANDLE file_fd;
+#else
+typedef int file_fd;
+#endif
+
+typedef struct {
+    uint64_t offset;
+    size_t want; // file bytes this read covers
+    size_t filled;
+    int state;
+    int err;
+} file_slot;
+
+typedef struct {
+    FpBlake3FileConfig cfg;
+    FpBlake3StreamSet mode;
+    FpBlake3Pool *pool;
+    file_fd fd;
+    uint64_t size;
+    uint64_t reads;
+    uint8_t *buffers;
+    size_t buffers_len;
+    file_slot slots[FP_BLAKE3_FILE_MAX_DEPTH];
+    // CVs of the completed power-of-two runs of buffers, as in the hasher.
+    uint32_t stack[64][8];
+    size_t stack_len;
+    uint8_t *output;
+    size_t output_len;
+    // Reader threads.
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t freed;
+    uint64_t next_read;
+    int stop;
+} file_job;
+
+void fp_blake3_file_defaults(FpBlake3FileConfig *cfg) {
+    cfg->queue_depth = 8;
+    cfg->read_bytes = 4u << 20;
+    cfg->reader_threads = 4;
+    cfg->direct = 1;
+    cfg->io_uring = 1;
+}
+
+static uint32_t clamp_u32(uint32_t v, uint32_t lo, uint32_t hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static uint32_t pow2_ceil_rec(uint32_t v, uint32_t p) {
+    if (p >= v) {
+        return p;
+    }
+    return pow2_ceil_rec(v, p * 2);
+}
+
+static uint8_t *slot_buffer(const file_job *job, size_t slot) {
+    return job->buffers + slot * job->cfg.read_bytes;
+}
+
+static void slot_prepare(file_job *job, uint64_t k) {
+    file_slot *s = &job->slots[k % job->cfg.queue_depth];
+    s->offset = k * job->cfg.read_bytes;
+    s->want = job->size - s->offset < job->cfg.read_bytes
+                  ? (size_t)(job->size - s->offset)
+                  : job->cfg.read_bytes;
+    s->filled = 0;
+    s->state = SLOT_READING;
+    s->err = 0;
+}
+
+// O_DIRECT reads must cover whole blocks; the one at EOF comes back short.
+static size_t read_len(const file_job *job, const file_slot *s) {
+    size_t len = s->want - s->filled;
+    if (job->cfg.direct) {
+        len = (len + FILE_ALIGN - 1) & ~(size_t)(FILE_ALIGN - 1);
+    }
+    return len;
+}
+
+static int hash_single(file_job *job, const uint8_t *input, size_t len) {
+    int err;
+    if (job->pool) {
+        err = fp_blake3_pool_hash(job->pool, &job->mode, input, len,
+                                  job->output, job->output_len);
+    } else {
+        FpBlake3Stream stream;
+        fp_blake3_stream_init(&job->mode, &stream);
+        err = fp_blake3_stream_update(&job->mode, &stream, input, len);
+        if (err == 0) {
+            fp_blake3_stream_finalize(&job->mode, &stream, job->output,
+                                      job->output_len);
+        }
+        fp_blake3_stream_release(&stream);
+    }
+    if (err != 0) {
+        errno = ENOMEM;
+    }
+    return err;
+}
+
+static void push_cv_rec(file_job *job, uint32_t cv[8], uint64_t total) {
+    if ((total & 1) != 0) {
+        memcpy(job->stack[job->stack_len++], cv, sizeof(job->stack[0]));
+        return;
+    }
+    job->stack_len--;
+    fp_blake3_parent_cv(&job->mode, job->stack[job->stack_len], cv, cv);
+    push_cv_rec(job, cv, total >> 1);
+}
+
+static void fold_root_rec(file_job *job, uint32_t cv[8]) {
+    job->stack_len--;
+    if (job->stack_len == 0) {
+        fp_blake3_parent_root(&job->mode, job->stack[0], cv, job->output,
+                              job->output_len);
+        return;
+    }
+    fp_blake3_parent_cv(&job->mode, job->stack[job->stack_len], cv, cv);
+    fold_root_rec(job, cv);
+}
+
+// Reads are a power-of-two number of chunks at matching offsets, so every
+// buffer is a subtree of the file's tree and only the last one can be
+// partial.
+static int consume(file_job *job, uint64_t k) {
+    size_t slot = k % job->cfg.queue_depth;
+    const uint8_t *input = slot_buffer(job, slot);
+    size_t len = job->slots[slot].want;
+    if (job->reads == 1) {
+        return hash_single(job, input, len);
+    }
+    uint32_t cv[8];
+    uint64_t counter = k * (job->cfg.read_bytes / FP_BLAKE3_CHUNK_LEN);
+    if (job->pool) {
+        if (fp_blake3_pool_subtree_cv(job->pool, &job->mode, input, len,
+                                      counter, cv) != 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+    } else {
+        fp_blake3_subtree_cv(&job->mode, input, len, counter, cv);
+    }
+    if (k + 1 < job->reads) {
+        push_cv_rec(job, cv, k + 1);
+    } else {
+        fold_root_rec(job, cv);
+    }
+    return 0;
+}
+
+static int slot_error(const file_slot *s) {
+    if (s->err != 0) {
+        errno = s->err;
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef __linux__
+typedef struct {
+    int fd;
+    int fixed;
+    unsigned inflight;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_len;
+    void *cq_ring;
+    size_t cq_len;
+    size_t sqes_len;
+} uring;
+
+static void *ring_map(int fd, size_t len, off_t offset) {
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static void uring_close(uring *u) {
+    if (u->sqes) {
+        munmap(u->sqes, u->sqes_len);
+    }
+    if (u->cq_ring && u->cq_ring != u->sq_ring) {
+        munmap(u->cq_ring, u->cq_len);
+    }
+    if (u->sq_ring) {
+        munmap(u->sq_ring, u->sq_len);
+    }
+    close(u->fd);
+}
+
+static void fill_iovecs_rec(struct iovec *iov, const file_job *job, size_t i) {
+    if (i == job->cfg.queue_depth) {
+        return;
+    }
+    iov[i].iov_base = slot_buffer(job, i);
+    iov[i].iov_len = job->cfg.read_bytes;
+    fill_iovecs_rec(iov, job, i + 1);
+}
+
+static int uring_open(uring *u, const file_job *job) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(u, 0, sizeof(*u));
+    u->fd = (int)syscall(__NR_io_uring_setup, job->cfg.queue_depth, &p);
+    if (u->fd < 0) {
+        return -1;
+    }
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_len > u->sq_len) {
+            u->sq_len = u->cq_len;
+        }
+        u->sq_ring = ring_map(u->fd, u->sq_len, IORING_OFF_SQ_RING);
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->sq_ring = ring_map(u->fd, u->sq_len, IORING_OFF_SQ_RING);
+        u->cq_ring = ring_map(u->fd, u->cq_len, IORING_OFF_CQ_RING);
+    }
+    u->sqes = (struct io_uring_sqe *)ring_map(u->fd, u->sqes_len,
+                                              IORING_OFF_SQES);
+    if (!u->sq_ring || !u->cq_ring || !u->sqes) {
+        uring_close(u);
+        return -1;
+    }
+    uint8_t *sq = (uint8_t *)u->sq_ring;
+    uint8_t *cq = (uint8_t *)u->cq_ring;
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // Registered buffers are pinned once instead of per read. They count
+    // against RLIMIT_MEMLOCK; without the budget, plain reads still work.
+    struct iovec iov[FP_BLAKE3_FILE_MAX_DEPTH];
+    fill_iovecs_rec(iov, job, 0);
+    u->fixed = syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS,
+                       iov, job->cfg.queue_depth) == 0;
+    return 0;
+}
+
+static int uring_enter(uring *u, unsigned submit, unsigned wait) {
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    long n = syscall(__NR_io_uring_enter, u->fd, submit, wait, flags, NULL, 0);
+    if (n < 0 && errno == EINTR) {
+        return uring_enter(u, submit, wait);
+    }
+    if (n >= 0 && (unsigned)n < submit) {
+        return uring_enter(u, submit - (unsigned)n, wait);
+    }
+    return n < 0 ? -1 : 0;
+}
+
+// Only this thread writes the SQ tail, and at most queue_depth reads are
+// ever in flight, so the ring never fills.
+static void uring_queue(uring *u, file_job *job, size_t slot) {
+    file_slot *s = &job->slots[slot];
+    unsigned tail = *u->sq_tail;
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = u->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = job->fd;
+    sqe->off = s->offset + s->filled;
+    sqe->addr = (uint64_t)(uintptr_t)(slot_buffer(job, slot) + s->filled);
+    sqe->len = (uint32_t)read_len(job, s);
+    sqe->buf_index = (uint16_t)slot;
+    sqe->user_data = slot;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->inflight++;
+}
+
+// Drains the CQ and returns how many short reads were queued again.
+static unsigned uring_reap_rec(uring *u, file_job *job, unsigned queued) {
+    unsigned head = *u->cq_head;
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        return queued;
+    }
+    const struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+    size_t slot = (size_t)cqe->user_data;
+    int res = cqe->res;
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    u->inflight--;
+
+    file_slot *s = &job->slots[slot];
+    if (res > 0) {
+        s->filled += (size_t)res;
+    }
+    if (res < 0) {
+        s->err = -res;
+    } else if (s->filled < s->want && res == 0) {
+        s->err = EIO; // the file shrank
+    } else if (s->filled < s->want && !job->stop) {
+        uring_queue(u, job, slot);
+        return uring_reap_rec(u, job, queued + 1);
+    }
+    s->state = SLOT_READY;
+    return uring_reap_rec(u, job, queued);
+}
+
+// Submits the queued reads and waits, in the same syscall, until the slot's
+// read has completed.
+static int uring_wait_rec(uring *u,
+                          file_job *job,
+                          size_t slot,
+                          unsigned queued) {
+    queued = uring_reap_rec(u, job, queued);
+    if (job->slots[slot].state == SLOT_READY) {
+        return queued ? uring_enter(u, queued, 0) : 0;
+    }
+    if (uring_enter(u, queued, 1) != 0) {
+        return -1;
+    }
+    return uring_wait_rec(u, job, slot, 0);
+}
+
+static int uring_run_rec(uring *u, file_job *job, uint64_t k, unsigned queued) {
+    if (k == job->reads) {
+        return 0;
+    }
+    size_t slot = k % job->cfg.queue_depth;
+    if (uring_wait_rec(u, job, slot, queued) != 0 ||
+        slot_error(&job->slots[slot]) != 0 || consume(job, k) != 0) {
+        return -1;
+    }
+    if (k + job->cfg.queue_depth >= job->reads) {
+        return uring_run_rec(u, job, k + 1, 0);
+    }
+    slot_prepare(job, k + job->cfg.queue_depth);
+    uring_queue(u, job, slot);
+    return uring_run_rec(u, job, k + 1, 1);
+}
+
+static unsigned uring_prime_rec(uring *u, file_job *job, uint64_t k) {
+    if (k == job->reads || k == job->cfg.queue_depth) {
+        return (unsigned)k;
+    }
+    slot_prepare(job, k);
+    uring_queue(u, job, (size_t)k);
+    return uring_prime_rec(u, job, k + 1);
+}
+
+// Buffers must not be freed under reads the kernel still owns. Returns -1
+// if they could not all be collected.
+static int uring_drain_rec(uring *u, file_job *job) {
+    uring_reap_rec(u, job, 0);
+    if (u->inflight == 0) {
+        return 0;
+    }
+    if (uring_enter(u, 0, 1) != 0) {
+        return -1;
+    }
+    return uring_drain_rec(u, job);
+}
+
+static int uring_run(file_job *job, int *drained) {
+    uring u;
+    if (uring_open(&u, job) != 0) {
+        return 1;
+    }
+    unsigned primed = uring_prime_rec(&u, job, 0);
+    int err = uring_run_rec(&u, job, 0, primed);
+    int saved = errno;
+    job->stop = 1;
+    *drained = uring_drain_rec(&u, job) == 0;
+    uring_close(&u);
+    errno = saved;
+    return err;
+}
+#endif
+
+static long read_at(file_job *job, uint8_t *buf, size_t len, uint64_t offset) {
+#ifdef _WIN32
+    OVERLAPPED ov;
+    DWORD got = 0;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    if (!ReadFile(job->fd, buf, (DWORD)len, &got, &ov)) {
+        if (GetLastError() == ERROR_HANDLE_EOF) {
+            return 0;
+        }
+        errno = EIO;
+        return -1;
+    }
+    return (long)got;
+#else
+    ssize_t n = pread(job->fd, buf, len, (off_t)offset);
+    if (n < 0 && errno == EINTR) {
+        return read_at(job, buf, len, offset);
+    }
+    return (long)n;
+#endif
+}
+
+static void read_slot_rec(file_job *job, size_t slot) {
+    file_slot *s = &job->slots[slot];
+    long n = read_at(job, slot_buffer(job, slot) + s->filled,
+                     read_len(job, s), s->offset + s->filled);
+    if (n < 0) {
+        s->err = errno;
+        return;
+    }
+    if (n == 0) {
+        s->err = EIO;
+        return;
+    }
+    s->filled += (size_t)n;
+    if (s->filled < s->want) {
+        read_slot_rec(job, slot);
+    }
+}
+
+// Readers claim reads in file order, each into its ring slot once the
+// consumer has freed it.
+static void *reader_main(void *arg) {
+    file_job *job = (file_job *)arg;
+    pthread_mutex_lock(&job->lock);
+    for (;;) {
+        uint64_t k = job->next_read;
+        if (job->stop || k == job->reads) {
+            break;
+        }
+        size_t slot = k % job->cfg.queue_depth;
+        if (job->slots[slot].state != SLOT_FREE) {
+            pthread_cond_wait(&job->freed, &job->lock);
+            continue;
+        }
+        job->next_read++;
+        slot_prepare(job, k);
+        pthread_mutex_unlock(&job->lock);
+        read_slot_rec(job, slot);
+        pthread_mutex_lock(&job->lock);
+        job->slots[slot].state = SLOT_READY;
+        pthread_cond_broadcast(&job->ready);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+static int threads_run_rec(file_job *job, uint64_t k) {
+    if (k == job->reads) {
+        return 0;
+    }
+    file_slot *s = &job->slots[k % job->cfg.queue_depth];
+    pthread_mutex_lock(&job->lock);
+    while (s->state != SLOT_READY) {
+        pthread_cond_wait(&job->ready, &job->lock);
+    }
+    pthread_mutex_unlock(&job->lock);
+    if (slot_error(s) != 0 || consume(job, k) != 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&job->lock);
+    s->state = SLOT_FREE;
+    pthread_cond_broadcast(&job->freed);
+    pthread_mutex_unlock(&job->lock);
+    return threads_run_rec(job, k + 1);
+}
+
+static size_t start_readers_rec(file_job *job,
+                                pthread_t *threads,
+                                size_t count,
+                                size_t started) {
+    if (started == count ||
+        pthread_create(&threads[started], NULL, reader_main, job) != 0) {
+        return started;
+    }
+    return start_readers_rec(job, threads, count, started + 1);
+}
+
+static void join_readers_rec(pthread_t *threads, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    pthread_join(threads[0], NULL);
+    join_readers_rec(threads + 1, count - 1);
+}
+
+static int threads_run(file_job *job) {
+    pthread_t threads[FP_BLAKE3_FILE_MAX_DEPTH];
+    size_t count = job->cfg.reader_threads;
+    if (count > job->reads) {
+        count = (size_t)job->reads;
+    }
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->ready, NULL);
+    pthread_cond_init(&job->freed, NULL);
+    size_t started = start_readers_rec(job, threads, count, 0);
+    int err = -1;
+    if (started != 0 || count == 0) {
+        err = threads_run_rec(job, 0);
+    } else {
+        errno = EAGAIN;
+    }
+    int saved = errno;
+    pthread_mutex_lock(&job->lock);
+    job->stop = 1;
+    pthread_cond_broadcast(&job->freed);
+    pthread_mutex_unlock(&job->lock);
+    join_readers_rec(threads, started);
+    pthread_cond_destroy(&job->freed);
+    pthread_cond_destroy(&job->ready);
+    pthread_mutex_destroy(&job->lock);
+    errno = saved;
+    return err;
+}
+
+static int file_open(file_job *job, const char *path) {
+#ifdef _WIN32
+    DWORD flags = FILE_FLAG_SEQUENTIAL_SCAN;
+    if (job->cfg.direct) {
+        flags = FILE_FLAG_NO_BUFFERING;
+    }
+    job->fd = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                          OPEN_EXISTING, flags, NULL);
+    if (job->fd == INVALID_HANDLE_VALUE && job->cfg.direct) {
+        job->cfg.direct = 0;
+        job->fd = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    }
+    LARGE_INTEGER size;
+    if (job->fd == INVALID_HANDLE_VALUE) {
+        errno = GetLastError() == ERROR_FILE_NOT_FOUND ? ENOENT : EIO;
+        return -1;
+    }
+    if (!GetFileSizeEx(job->fd, &size)) {
+        CloseHandle(job->fd);
+        errno = EIO;
+        return -1;
+    }
+    job->size = (uint64_t)size.QuadPart;
+    return 0;
+#else
+    job->fd = -1;
+#ifdef O_DIRECT
+    if (job->cfg.direct) {
+        job->fd = open(path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+        if (job->fd < 0 && errno != EINVAL) {
+            return -1;
+        }
+    }
+#endif
+    if (job->fd < 0) {
+        // tmpfs and some network filesystems refuse O_DIRECT.
+        job->cfg.direct = 0;
+        job->fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (job->fd < 0) {
+            return -1;
+        }
+    }
+    // SEEK_END also sizes block devices, where st_size is 0.
+    off_t size = lseek(job->fd, 0, SEEK_END);
+    if (size < 0) {
+        int saved = errno;
+        close(job->fd);
+        errno = saved;
+        return -1;
+    }
+    job->size = (uint64_t)size;
+    return 0;
+#endif
+}
+
+static void file_close(file_job *job) {
+#ifdef _WIN32
+    CloseHandle(job->fd);
+#else
+    close(job->fd);
+#endif
+}
+
+static uint8_t *buffers_alloc(size_t len) {
+#ifdef __linux__
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : (uint8_t *)p;
+#elif defined(_WIN32)
+    return (uint8_t *)VirtualAlloc(NULL, len, MEM_COMMIT | MEM_RESERVE,
+                                   PAGE_READWRITE);
+#else
+    void *p = NULL;
+    return posix_memalign(&p, FILE_ALIGN, len) == 0 ? (uint8_t *)p : NULL;
+#endif
+}
+
+static void buffers_free(uint8_t *p, size_t len) {
+#ifdef __linux__
+    munmap(p, len);
+#elif defined(_WIN32)
+    (void)len;
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    (void)len;
+    free(p);
+#endif
+}
+
+int fp_blake3_file_hash(const FpBlake3FileConfig *cfg,
+                        const FpBlake3StreamSet *mode,
+                        FpBlake3Pool *pool,
+                        const char *path,
+                        uint8_t *output,
+                        size_t output_len) {
+    file_job job;
+    memset(&job, 0, sizeof(job));
+    job.cfg = *cfg;
+    job.cfg.read_bytes = pow2_ceil_rec(clamp_u32(cfg->read_bytes,
+                                                 FP_BLAKE3_FILE_MIN_READ,
+                                                 FP_BLAKE3_FILE_MAX_READ),
+                                       FP_BLAKE3_FILE_MIN_READ);
+    job.cfg.queue_depth = clamp_u32(cfg->queue_depth, 1,
+                                    FP_BLAKE3_FILE_MAX_DEPTH);
+    job.cfg.reader_threads = clamp_u32(cfg->reader_threads, 1,
+                                       job.cfg.queue_depth);
+    if (mode) {
+        job.mode = *mode;
+    } else {
+        fp_blake3_stream_set_init(&job.mode);
+    }
+    job.pool = pool;
+    job.output = output;
+    job.output_len = output_len;
+    if (file_open(&job, path) != 0) {
+        return -1;
+    }
+    job.reads = (job.size + job.cfg.read_bytes - 1) / job.cfg.read_bytes;
+    if (job.reads < job.cfg.queue_depth) {
+        job.cfg.queue_depth = job.reads ? (uint32_t)job.reads : 1;
+    }
+    job.buffers_len = (size_t)job.cfg.queue_depth * job.cfg.read_bytes;
+    job.buffers = buffers_alloc(job.buffers_len);
+    if (!job.buffers) {
+        file_close(&job);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int engine = FP_BLAKE3_FILE_THREADS;
+    int drained = 1;
+    int err = 1;
+#ifdef __linux__
+    if (job.cfg.io_uring) {
+        err = uring_run(&job, &drained);
+        engine = FP_BLAKE3_FILE_IO_URING;
+    }
+#endif
+    if (err > 0) {
+        engine = FP_BLAKE3_FILE_THREADS;
+        err = threads_run(&job);
+    }
+    if (err == 0 && job.reads == 0) {
+        err = hash_single(&job, job.buffers, 0);
+    }
+    int saved = errno;
+    if (drained) {
+        buffers_free(job.buffers, job.buffers_len);
+    }
+    file_close(&job);
+    errno = saved;
+    return err == 0 ? engine : -1;
+}
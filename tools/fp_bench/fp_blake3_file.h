@@ -0,0 +1,46 @@
+#pragma once
+
+#include "fp_blake3_parallel.h"
+
+#define FP_BLAKE3_FILE_MAX_DEPTH 64
+#define FP_BLAKE3_FILE_MIN_READ  (64 * 1024)
+#define FP_BLAKE3_FILE_MAX_READ  (64 * 1024 * 1024)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// File hashing for scans that should not go through the page cache. Reads
+// of read_bytes each land in aligned buffers and queue_depth of them are
+// kept in flight. On Linux they are issued through io_uring (raw syscalls,
+// registered buffers when the memlock limit allows); elsewhere, or when
+// io_uring can't be set up, reader threads issue them with pread. Buffers
+// are hashed in file order as they complete, each full one as a subtree.
+typedef struct {
+    uint32_t queue_depth;    // 1..FP_BLAKE3_FILE_MAX_DEPTH
+    uint32_t read_bytes;     // rounded up to a power of two in MIN..MAX_READ
+    uint32_t reader_threads; // pread threads when io_uring is not used
+    int direct;              // O_DIRECT, dropped where the filesystem refuses
+    int io_uring;            // 0 goes straight to the reader threads
+} FpBlake3FileConfig;
+
+enum {
+    FP_BLAKE3_FILE_THREADS = 0,
+    FP_BLAKE3_FILE_IO_URING = 1,
+};
+
+void fp_blake3_file_defaults(FpBlake3FileConfig *cfg);
+// Hashes the file at path in the given mode (NULL for plain hashing) and
+// writes output_len root bytes. Buffers are hashed on pool when it is not
+// NULL, otherwise on the calling thread. Returns the engine that ran, or -1
+// with errno set.
+int fp_blake3_file_hash(const FpBlake3FileConfig *cfg,
+                        const FpBlake3StreamSet *mode,
+                        FpBlake3Pool *pool,
+                        const char *path,
+                        uint8_t *output,
+                        size_t output_len);
+
+#ifdef __cplusplus
+}
+#endif
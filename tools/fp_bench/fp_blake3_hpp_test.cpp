@@ -0,0 +1,189 @@
+#include "fp_blake3.hpp"
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static_assert(!fp_blake3::ByteRange<char[4]>);
+static_assert(!fp_blake3::ByteRange<const char (&)[4]>);
+static_assert(fp_blake3::ByteRange<std::string>);
+static_assert(fp_blake3::ByteRange<std::array<char, 3>>);
+
+// BLAKE3("abc") from the reference implementation.
+static const std::uint8_t abc_digest[fp_blake3::out_len] = {
+    0x64, 0x37, 0xb3, 0xac, 0x38, 0x46, 0x51, 0x33, 0xff, 0xb6, 0x3b,
+    0x75, 0x27, 0x3a, 0x8d, 0xb5, 0x48, 0xc5, 0x58, 0x46, 0x5d, 0x79,
+    0xdb, 0x03, 0xfd, 0x35, 0x9c, 0x6c, 0xd5, 0xbd, 0x9d, 0x85,
+};
+
+static const char context[] = "fp_blake3.hpp test";
+
+// Lengths around block, chunk and batch-window boundaries. There are more
+// of them than either batch window (16 streams, 32 derive lanes).
+static const std::size_t lens[] = {
+    0,    1,    3,    63,   64,   65,   100,  1023, 1024, 1025, 2048,
+    3000, 4096, 5000, 7000, 8193, 0,    31,   32,   33,   64,   64,
+    64,   64,   64,   64,   64,   64,   128,  200,  1024, 1024, 9000,
+    12,   12,   12,   12,   12,   12,   12,   12,   12,   4097,
+};
+constexpr std::size_t input_count = sizeof(lens) / sizeof(lens[0]);
+constexpr std::size_t max_len = 9000;
+
+#if defined(__GLIBC__)
+// Lets the test fail the stream spill allocation, which goes through
+// realloc, to reach the std::bad_alloc path of the batch overloads.
+extern "C" void *__libc_realloc(void *p, std::size_t n);
+static bool fail_realloc = false;
+
+extern "C" void *realloc(void *p, std::size_t n) noexcept {
+    return fail_realloc ? nullptr : __libc_realloc(p, n);
+}
+#endif
+
+static void fail(const char *what, std::size_t i) {
+    std::fprintf(stderr, "fp_blake3.hpp test failed for %s (%zu)\n", what,
+                 i);
+    std::exit(1);
+}
+
+static void expect(const fp_blake3::Digest &got,
+                   const std::uint8_t *want,
+                   const char *what,
+                   std::size_t i = 0) {
+    if (std::memcmp(got.data(), want, fp_blake3::out_len) != 0) {
+        fail(what, i);
+    }
+}
+
+static const std::uint8_t *u8(const std::byte *p) {
+    return reinterpret_cast<const std::uint8_t *>(p);
+}
+
+// Reference digest and XOF output from the C hasher.
+static void c_reference(FpBlake3Hasher &h,
+                        std::span<const std::byte> input,
+                        std::uint8_t *digest,
+                        std::span<std::uint8_t> xof) {
+    fp_blake3_hasher_update(&h, u8(input.data()), input.size());
+    fp_blake3_hasher_finalize(&h, digest);
+    fp_blake3_hasher_finalize_xof(&h, xof.data(), xof.size());
+}
+
+// Feeds input in two uneven pieces, checks digest and XOF, then resets and
+// feeds it again in one piece.
+template <fp_blake3::Mode M>
+static void check_hasher(fp_blake3::Hasher<M> &h,
+                         FpBlake3Hasher &ref,
+                         std::span<const std::byte> input,
+                         const char *what,
+                         std::size_t i) {
+    std::uint8_t digest[fp_blake3::out_len];
+    std::array<std::uint8_t, 131> xof;
+    std::array<std::byte, 131> got;
+    c_reference(ref, input, digest, xof);
+    std::size_t split = input.size() / 3;
+    h.update(input.first(split)).update(input.subspan(split));
+    expect(h.finalize(), digest, what, i);
+    h.finalize_xof(got);
+    if (std::memcmp(got.data(), xof.data(), xof.size()) != 0) {
+        fail(what, i);
+    }
+    h.update(input);
+    h.reset();
+    h.update(input);
+    expect(h.finalize(), digest, what, i);
+}
+
+int main() {
+    using namespace fp_blake3;
+    expect(hash("abc"), abc_digest, "a string literal");
+    expect(hash(std::string("abc")), abc_digest, "std::string");
+    expect(hash(std::string_view("abc")), abc_digest, "std::string_view");
+    expect(hash(std::vector<char>{'a', 'b', 'c'}), abc_digest, "a vector");
+    expect(Hasher<Mode::hash>().update("ab").update("c").finalize(),
+           abc_digest, "Hasher::update");
+
+    std::vector<std::byte> data(max_len);
+    for (std::size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<std::byte>(i % 251);
+    }
+    std::array<std::byte, key_len> key;
+    for (std::size_t i = 0; i < key.size(); i++) {
+        key[i] = static_cast<std::byte>(0xa0 + i);
+    }
+    DeriveKeyContext ctx(context);
+    std::uint8_t want[out_len];
+
+    const auto *abc = reinterpret_cast<const std::uint8_t *>("abc");
+    fp_blake3_hash_keyed(u8(key.data()), abc, 3, want);
+    expect(keyed_hash(key, "abc"), want, "keyed_hash");
+    fp_blake3_derive_key(context, sizeof(context) - 1, abc, 3, want);
+    expect(derive_key(ctx, "abc"), want, "derive_key");
+
+    // Each input starts at a different offset so neighbours differ.
+    std::vector<std::span<const std::byte>> inputs;
+    for (std::size_t i = 0; i < input_count; i++) {
+        std::size_t offset = i % 7;
+        inputs.push_back(
+            std::span<const std::byte>(data).subspan(offset).first(
+                lens[i] < max_len - offset ? lens[i] : max_len - offset));
+    }
+
+    Hasher<Mode::hash> plain;
+    Hasher<Mode::keyed> keyed{KeyView(key)};
+    Hasher<Mode::derive_key> derived{ctx};
+    for (std::size_t i = 0; i < input_count; i++) {
+        FpBlake3Hasher ref;
+        plain.reset();
+        fp_blake3_hasher_init(&ref);
+        check_hasher(plain, ref, inputs[i], "Hasher<hash>", i);
+        keyed.reset();
+        fp_blake3_hasher_init_keyed(&ref, u8(key.data()));
+        check_hasher(keyed, ref, inputs[i], "Hasher<keyed>", i);
+        derived.reset();
+        fp_blake3_hasher_init_derive_key_ctx(&ref, &ctx.native());
+        check_hasher(derived, ref, inputs[i], "Hasher<derive_key>", i);
+    }
+
+    std::vector<Digest> out(input_count);
+    hash_batch(inputs, out);
+    for (std::size_t i = 0; i < input_count; i++) {
+        fp_blake3_hash(u8(inputs[i].data()), inputs[i].size(), want);
+        expect(out[i], want, "hash_batch", i);
+    }
+    keyed_hash_batch(key, inputs, out);
+    for (std::size_t i = 0; i < input_count; i++) {
+        fp_blake3_hash_keyed(u8(key.data()), u8(inputs[i].data()),
+                             inputs[i].size(), want);
+        expect(out[i], want, "keyed_hash_batch", i);
+    }
+    derive_keys(ctx, inputs, out);
+    for (std::size_t i = 0; i < input_count; i++) {
+        fp_blake3_derive_key_ctx(&ctx.native(), u8(inputs[i].data()),
+                                 inputs[i].size(), want);
+        expect(out[i], want, "derive_keys", i);
+    }
+
+#if defined(__GLIBC__)
+    // 8193 bytes is enough chunks to need a spill block.
+    bool threw = false;
+    fail_realloc = true;
+    try {
+        hash_batch(inputs, out);
+    } catch (const std::bad_alloc &) {
+        threw = true;
+    }
+    fail_realloc = false;
+    if (!threw) {
+        fail("hash_batch allocation failure", 0);
+    }
+#endif
+    std::printf("fp_blake3.hpp ok\n");
+    return 0;
+}
@@ -0,0 +1,876 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "fp_blake3_parallel.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+enum {
+    ARENA_GRANULE = 2 * 1024 * 1024,
+    PAGE_BYTES = 4096,
+    SUBTREES_PER_THREAD = 4,
+};
+
+typedef struct {
+    uint8_t *base;
+    size_t cap;
+} pool_arena;
+
+typedef struct {
+    _Alignas(64) atomic_size_t next;
+    size_t end;
+} node_queue;
+
+// One Merkle level, claimed span parents at a time.
+typedef struct {
+    _Alignas(64) atomic_size_t next;
+    const uint8_t *key;
+    const uint8_t *nodes;
+    uint8_t *out;
+    size_t parents;
+    size_t span;
+} merkle_job;
+
+typedef struct {
+    FpBlake3Pool *pool;
+    pthread_t thread;
+    int cpu;
+    size_t bucket;
+} pool_worker;
+
+struct FpBlake3Pool {
+    FpBlake3PoolConfig cfg;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    uint64_t generation;
+    size_t running;
+    size_t started;
+    int stop;
+    pool_worker *workers;
+    size_t threads;
+    size_t nodes;
+    int node_ids[FP_BLAKE3_POOL_MAX_NODES];
+    node_queue queues[FP_BLAKE3_POOL_MAX_NODES];
+    // Shared per-call scratch: merged CVs, page addresses, node status and
+    // the node-grouped subtree order, or the spare Merkle level.
+    pool_arena arena;
+    FpBlake3StreamSet mode;
+    const uint8_t *input;
+    size_t len;
+    uint64_t counter;
+    size_t subtree_len;
+    size_t subtrees;
+    uint32_t (*cvs)[8];
+    size_t *order;
+    // Set instead of the subtree fields while a Merkle level is running.
+    merkle_job *merkle;
+};
+
+static void arena_free(pool_arena *a) {
+#ifdef __linux__
+    if (a->base) {
+        munmap(a->base, a->cap);
+    }
+#else
+    free(a->base);
+#endif
+    a->base = NULL;
+    a->cap = 0;
+}
+
+// The scratch arena only grows, in 2 MiB steps, so calls on one pool reuse
+// the same mapping.
+static int arena_reserve(pool_arena *a, size_t bytes, int huge_pages) {
+    if (bytes <= a->cap) {
+        return 0;
+    }
+    arena_free(a);
+    size_t cap = (bytes + ARENA_GRANULE - 1) / ARENA_GRANULE * ARENA_GRANULE;
+#ifdef __linux__
+    void *p = MAP_FAILED;
+    if (huge_pages) {
+        p = mmap(NULL, cap, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, cap, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return -1;
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge_pages) {
+            madvise(p, cap, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    a->base = (uint8_t *)p;
+#else
+    (void)huge_pages;
+    a->base = (uint8_t *)malloc(cap);
+    if (!a->base) {
+        return -1;
+    }
+#endif
+    a->cap = cap;
+    return 0;
+}
+
+static size_t pow2_floor_rec(size_t v, size_t p) {
+    if (p > v / 2) {
+        return p;
+    }
+    return pow2_floor_rec(v, p * 2);
+}
+
+static size_t pow2_ceil_rec(size_t v, size_t p) {
+    if (p >= v) {
+        return p;
+    }
+    return pow2_ceil_rec(v, p * 2);
+}
+
+static size_t online_cpus(void) {
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        return (size_t)CPU_COUNT(&set);
+    }
+    return 1;
+#elif defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+#endif
+}
+
+#ifdef __linux__
+static void assign_cpus_rec(pool_worker *workers,
+                            size_t threads,
+                            const cpu_set_t *set,
+                            int cpu,
+                            size_t next) {
+    if (next == threads) {
+        return;
+    }
+    if (cpu >= CPU_SETSIZE) {
+        // More workers than allowed CPUs: wrap around the mask.
+        assign_cpus_rec(workers, threads, set, 0, next);
+        return;
+    }
+    if (CPU_ISSET(cpu, set)) {
+        workers[next].cpu = cpu;
+        assign_cpus_rec(workers, threads, set, cpu + 1, next + 1);
+        return;
+    }
+    assign_cpus_rec(workers, threads, set, cpu + 1, next);
+}
+#endif
+
+static void assign_cpus(FpBlake3Pool *pool) {
+#ifdef __linux__
+    cpu_set_t set;
+    if (pool->cfg.numa && sched_getaffinity(0, sizeof(set), &set) == 0 &&
+        CPU_COUNT(&set) > 0) {
+        assign_cpus_rec(pool->workers, pool->threads, &set, 0, 0);
+    }
+#else
+    (void)pool;
+#endif
+}
+
+// Pins the calling worker to its CPU and returns that CPU's node, or -1.
+static int worker_bind(const pool_worker *w) {
+#ifdef __linux__
+    if (w->cpu >= 0) {
+        cpu_set_t set;
+        unsigned cpu;
+        unsigned node;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 &&
+            syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+            return (int)node;
+        }
+    }
+#else
+    (void)w;
+#endif
+    return -1;
+}
+
+static size_t find_bucket_rec(const FpBlake3Pool *pool, int node, size_t b) {
+    if (b == pool->nodes || pool->node_ids[b] == node) {
+        return b;
+    }
+    return find_bucket_rec(pool, node, b + 1);
+}
+
+// Called with the lock held while workers start up.
+static size_t register_node(FpBlake3Pool *pool, int node) {
+    size_t b = find_bucket_rec(pool, node, 0);
+    if (b < pool->nodes) {
+        return b;
+    }
+    if (pool->nodes == FP_BLAKE3_POOL_MAX_NODES) {
+        return 0;
+    }
+    pool->node_ids[pool->nodes] = node;
+    return pool->nodes++;
+}
+
+// Writes straight into the merged CV array. Each worker stores one CV per
+// subtree it hashed, so sharing cache lines there costs next to nothing.
+static void hash_subtree(FpBlake3Pool *pool, size_t idx) {
+    size_t offset = idx * pool->subtree_len;
+    size_t len = pool->len - offset;
+    if (len > pool->subtree_len) {
+        len = pool->subtree_len;
+    }
+    fp_blake3_subtree_cv(&pool->mode,
+                         pool->input + offset,
+                         len,
+                         pool->counter + offset / FP_BLAKE3_CHUNK_LEN,
+                         pool->cvs[idx]);
+}
+
+// Drains the worker's own node first, then steals from the other nodes in
+// turn.
+static void worker_drain_rec(pool_worker *w, size_t bucket, size_t visited) {
+    FpBlake3Pool *pool = w->pool;
+    if (visited == pool->nodes) {
+        return;
+    }
+    node_queue *q = &pool->queues[bucket];
+    size_t slot = atomic_fetch_add_explicit(&q->next, 1,
+                                            memory_order_relaxed);
+    if (slot >= q->end) {
+        worker_drain_rec(w, (bucket + 1) % pool->nodes, visited + 1);
+        return;
+    }
+    hash_subtree(pool, pool->order[slot]);
+    worker_drain_rec(w, bucket, visited);
+}
+
+static void merkle_drain_rec(merkle_job *job) {
+    size_t first = atomic_fetch_add_explicit(&job->next, job->span,
+                                             memory_order_relaxed);
+    if (first >= job->parents) {
+        return;
+    }
+    size_t n = job->parents - first;
+    if (n > job->span) {
+        n = job->span;
+    }
+    fp_blake3_hash_blocks64(job->key,
+                            job->nodes + first * 2 * FP_BLAKE3_OUT_LEN,
+                            n,
+                            job->out + first * FP_BLAKE3_OUT_LEN);
+    merkle_drain_rec(job);
+}
+
+static void worker_run(pool_worker *w) {
+    if (w->pool->merkle) {
+        merkle_drain_rec(w->pool->merkle);
+        return;
+    }
+    worker_drain_rec(w, w->bucket, 0);
+}
+
+static void *worker_main(void *arg) {
+    pool_worker *w = (pool_worker *)arg;
+    FpBlake3Pool *pool = w->pool;
+    int node = worker_bind(w);
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    w->bucket = register_node(pool, node);
+    pool->started++;
+    pthread_cond_broadcast(&pool->done);
+    for (;;) {
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        worker_run(w);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void join_workers_rec(FpBlake3Pool *pool, size_t idx, size_t count) {
+    if (idx == count) {
+        return;
+    }
+    pthread_join(pool->workers[idx].thread, NULL);
+    join_workers_rec(pool, idx + 1, count);
+}
+
+static void pool_shutdown(FpBlake3Pool *pool, size_t created) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    join_workers_rec(pool, 0, created);
+    arena_free(&pool->arena);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+static void init_workers_rec(FpBlake3Pool *pool, size_t idx) {
+    if (idx == pool->threads) {
+        return;
+    }
+    pool->workers[idx].pool = pool;
+    pool->workers[idx].cpu = -1;
+    init_workers_rec(pool, idx + 1);
+}
+
+static size_t start_workers_rec(FpBlake3Pool *pool, size_t idx) {
+    if (idx == pool->threads) {
+        return idx;
+    }
+    pool_worker *w = &pool->workers[idx];
+    if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+        return idx;
+    }
+    return start_workers_rec(pool, idx + 1);
+}
+
+void fp_blake3_pool_defaults(FpBlake3PoolConfig *cfg) {
+    cfg->threads = 0;
+    cfg->min_subtree_chunks = 256;
+    cfg->min_parallel_bytes = 4u << 20;
+    cfg->numa = 1;
+    cfg->huge_pages = 1;
+}
+
+FpBlake3Pool *fp_blake3_pool_create(const FpBlake3PoolConfig *cfg) {
+    FpBlake3Pool *pool = (FpBlake3Pool *)calloc(1, sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->cfg = *cfg;
+    pool->cfg.min_subtree_chunks =
+        (uint32_t)pow2_ceil_rec(cfg->min_subtree_chunks, 1);
+    pool->threads = cfg->threads ? cfg->threads : online_cpus();
+    pool->workers = (pool_worker *)calloc(pool->threads,
+                                          sizeof(pool->workers[0]));
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    init_workers_rec(pool, 0);
+    assign_cpus(pool);
+
+    size_t created = start_workers_rec(pool, 0);
+    if (created != pool->threads) {
+        pool_shutdown(pool, created);
+        return NULL;
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (pool->started != pool->threads) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return pool;
+}
+
+void fp_blake3_pool_destroy(FpBlake3Pool *pool) {
+    if (pool) {
+        pool_shutdown(pool, pool->threads);
+    }
+}
+
+size_t fp_blake3_pool_threads(const FpBlake3Pool *pool) {
+    return pool->threads;
+}
+
+size_t fp_blake3_pool_nodes(const FpBlake3Pool *pool) {
+    return pool->nodes;
+}
+
+static size_t subtree_chunks_for(const FpBlake3Pool *pool, size_t chunks) {
+    size_t target = chunks / (SUBTREES_PER_THREAD * pool->threads);
+    size_t span = target > 1 ? pow2_floor_rec(target, 1) : 1;
+    return span < pool->cfg.min_subtree_chunks
+        ? pool->cfg.min_subtree_chunks
+        : span;
+}
+
+static void page_addrs_rec(const FpBlake3Pool *pool, void **pages, size_t idx) {
+    if (idx == pool->subtrees) {
+        return;
+    }
+    uintptr_t addr = (uintptr_t)(pool->input + idx * pool->subtree_len);
+    pages[idx] = (void *)(addr & ~(uintptr_t)(PAGE_BYTES - 1));
+    page_addrs_rec(pool, pages, idx + 1);
+}
+
+static void buckets_rec(const FpBlake3Pool *pool,
+                        int *status,
+                        int located,
+                        size_t idx) {
+    if (idx == pool->subtrees) {
+        return;
+    }
+    size_t b = located && status[idx] >= 0
+        ? find_bucket_rec(pool, status[idx], 0)
+        : pool->nodes;
+    status[idx] = (int)(b < pool->nodes ? b : idx % pool->nodes);
+    buckets_rec(pool, status, located, idx + 1);
+}
+
+// Maps each subtree to the bucket of the node that owns its first page.
+// move_pages with no target nodes only reports placement. Pages that are
+// not faulted in yet, or nodes without a worker, fall back to round-robin.
+static void locate_subtrees(FpBlake3Pool *pool, void **pages, int *status) {
+    int located = 0;
+#ifdef __linux__
+    if (pool->cfg.numa && pool->nodes > 1) {
+        page_addrs_rec(pool, pages, 0);
+        located = syscall(SYS_move_pages, 0, (unsigned long)pool->subtrees,
+                          pages, NULL, status, 0) == 0;
+    }
+#else
+    (void)pages;
+    (void)page_addrs_rec;
+#endif
+    buckets_rec(pool, status, located, 0);
+}
+
+static void count_buckets_rec(const int *bucket,
+                              size_t n,
+                              size_t *counts) {
+    if (n == 0) {
+        return;
+    }
+    counts[bucket[0]]++;
+    count_buckets_rec(bucket + 1, n - 1, counts);
+}
+
+static void open_queues_rec(FpBlake3Pool *pool,
+                            const size_t *counts,
+                            size_t *fill,
+                            size_t b,
+                            size_t begin) {
+    if (b == pool->nodes) {
+        return;
+    }
+    atomic_store_explicit(&pool->queues[b].next, begin, memory_order_relaxed);
+    fill[b] = begin;
+    pool->queues[b].end = begin + counts[b];
+    open_queues_rec(pool, counts, fill, b + 1, begin + counts[b]);
+}
+
+static void fill_order_rec(FpBlake3Pool *pool,
+                           const int *bucket,
+                           size_t *fill,
+                           size_t idx) {
+    if (idx == pool->subtrees) {
+        return;
+    }
+    pool->order[fill[bucket[idx]]++] = idx;
+    fill_order_rec(pool, bucket, fill, idx + 1);
+}
+
+// Groups subtree indices by bucket, each group in input order.
+static void build_queues(FpBlake3Pool *pool, const int *bucket) {
+    size_t counts[FP_BLAKE3_POOL_MAX_NODES] = {0};
+    size_t fill[FP_BLAKE3_POOL_MAX_NODES];
+    count_buckets_rec(bucket, pool->subtrees, counts);
+    open_queues_rec(pool, counts, fill, 0, 0);
+    fill_order_rec(pool, bucket, fill, 0);
+}
+
+// Subtrees are equal powers of two except the last, so every left-balanced
+// split of the tree falls on a subtree boundary.
+static void merge_rec(const FpBlake3Pool *pool,
+                      size_t first,
+                      size_t count,
+                      uint32_t cv[8]) {
+    if (count == 1) {
+        memcpy(cv, pool->cvs[first], sizeof(pool->cvs[0]));
+        return;
+    }
+    size_t left_count = pow2_floor_rec(count - 1, 1);
+    uint32_t left[8];
+    uint32_t right[8];
+    merge_rec(pool, first, left_count, left);
+    merge_rec(pool, first + left_count, count - left_count, right);
+    fp_blake3_parent_cv(&pool->mode, left, right, cv);
+}
+
+// Wakes every worker for the call set up in pool and waits for them all.
+static void pool_run(FpBlake3Pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->running = pool->threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    while (pool->running != 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static int hash_serial(const FpBlake3StreamSet *mode,
+                       const uint8_t *input,
+                       size_t len,
+                       uint8_t *output,
+                       size_t output_len) {
+    FpBlake3Stream stream;
+    fp_blake3_stream_init(mode, &stream);
+    int err = fp_blake3_stream_update(mode, &stream, input, len);
+    if (err == 0) {
+        fp_blake3_stream_finalize(mode, &stream, output, output_len);
+    }
+    fp_blake3_stream_release(&stream);
+    return err;
+}
+
+// Hashes input on the workers and leaves the two halves of its top-level
+// split in left and right. Returns 1 if input is too small to be worth
+// splitting, in which case nothing is hashed.
+static int pool_split(FpBlake3Pool *pool,
+                      const FpBlake3StreamSet *mode,
+                      const uint8_t *input,
+                      size_t len,
+                      uint64_t counter,
+                      uint32_t left[8],
+                      uint32_t right[8]) {
+    size_t chunks = (len + FP_BLAKE3_CHUNK_LEN - 1) / FP_BLAKE3_CHUNK_LEN;
+    size_t span = subtree_chunks_for(pool, chunks);
+    if (len < pool->cfg.min_parallel_bytes || pool->threads < 2 ||
+        chunks <= span) {
+        return 1;
+    }
+
+    size_t n = (chunks + span - 1) / span;
+    size_t per_subtree = sizeof(uint32_t[8]) + sizeof(void *) +
+                         sizeof(size_t) + sizeof(int);
+    if (arena_reserve(&pool->arena, n * per_subtree,
+                      pool->cfg.huge_pages) != 0) {
+        return -1;
+    }
+    pool->mode = *mode;
+    pool->input = input;
+    pool->len = len;
+    pool->counter = counter;
+    pool->subtree_len = span * FP_BLAKE3_CHUNK_LEN;
+    pool->subtrees = n;
+    pool->cvs = (uint32_t (*)[8])pool->arena.base;
+    void **pages = (void **)(pool->arena.base + n * sizeof(uint32_t[8]));
+    pool->order = (size_t *)(pages + n);
+    int *status = (int *)(pool->order + n);
+    locate_subtrees(pool, pages, status);
+    build_queues(pool, status);
+    pool_run(pool);
+
+    size_t left_count = pow2_floor_rec(n - 1, 1);
+    merge_rec(pool, 0, left_count, left);
+    merge_rec(pool, left_count, n - left_count, right);
+    return 0;
+}
+
+int fp_blake3_pool_hash(FpBlake3Pool *pool,
+                        const FpBlake3StreamSet *mode,
+                        const uint8_t *input,
+                        size_t len,
+                        uint8_t *output,
+                        size_t output_len) {
+    FpBlake3StreamSet plain;
+    if (!mode) {
+        fp_blake3_stream_set_init(&plain);
+        mode = &plain;
+    }
+    uint32_t left[8];
+    uint32_t right[8];
+    int split = pool_split(pool, mode, input, len, 0, left, right);
+    if (split > 0) {
+        return hash_serial(mode, input, len, output, output_len);
+    }
+    if (split < 0) {
+        return -1;
+    }
+    fp_blake3_parent_root(mode, left, right, output, output_len);
+    return 0;
+}
+
+int fp_blake3_pool_subtree_cv(FpBlake3Pool *pool,
+                              const FpBlake3StreamSet *mode,
+                              const uint8_t *input,
+                              size_t len,
+                              uint64_t chunk_counter,
+                              uint32_t cv[8]) {
+    FpBlake3StreamSet plain;
+    if (!mode) {
+        fp_blake3_stream_set_init(&plain);
+        mode = &plain;
+    }
+    uint32_t left[8];
+    uint32_t right[8];
+    int split = pool_split(pool, mode, input, len, chunk_counter, left, right);
+    if (split > 0) {
+        fp_blake3_subtree_cv(mode, input, len, chunk_counter, cv);
+        return 0;
+    }
+    if (split < 0) {
+        return -1;
+    }
+    fp_blake3_parent_cv(mode, left, right, cv);
+    return 0;
+}
+
+// Parents per claim: a multiple of the 8-way kernel width, sized like the
+// subtrees so each worker gets a few claims. Returns 0 when the level is
+// better built on the calling thread.
+static size_t merkle_span_for(const FpBlake3Pool *pool, size_t count) {
+    size_t parents = count / 2;
+    size_t span = (parents / (SUBTREES_PER_THREAD * pool->threads) + 7) &
+                  ~(size_t)7;
+    if (span < 8) {
+        span = 8;
+    }
+    if (count * FP_BLAKE3_OUT_LEN < pool->cfg.min_parallel_bytes ||
+        pool->threads < 2 || parents <= span) {
+        return 0;
+    }
+    return span;
+}
+
+size_t fp_blake3_pool_merkle_level(FpBlake3Pool *pool,
+                                   const uint8_t *key,
+                                   const uint8_t *nodes,
+                                   size_t count,
+                                   uint8_t *out) {
+    size_t span = merkle_span_for(pool, count);
+    if (span == 0) {
+        return fp_blake3_merkle_level(key, nodes, count, out);
+    }
+    merkle_job job;
+    atomic_init(&job.next, 0);
+    job.key = key;
+    job.nodes = nodes;
+    job.out = out;
+    job.parents = count / 2;
+    job.span = span;
+    pool->merkle = &job;
+    pool_run(pool);
+    pool->merkle = NULL;
+    if ((count & 1) == 0) {
+        return job.parents;
+    }
+    memcpy(out + job.parents * FP_BLAKE3_OUT_LEN,
+           nodes + (count - 1) * FP_BLAKE3_OUT_LEN,
+           FP_BLAKE3_OUT_LEN);
+    return job.parents + 1;
+}
+
+// Alternates between the caller's buffer and the pool scratch until the
+// level is small enough to finish in place on this thread.
+static void merkle_root_rec(FpBlake3Pool *pool,
+                            const uint8_t *key,
+                            uint8_t *level,
+                            uint8_t *spare,
+                            size_t count,
+                            uint8_t *root) {
+    if (merkle_span_for(pool, count) == 0) {
+        fp_blake3_merkle_root(key, level, count, root);
+        return;
+    }
+    size_t next = fp_blake3_pool_merkle_level(pool, key, level, count, spare);
+    merkle_root_rec(pool, key, spare, level, next, root);
+}
+
+int fp_blake3_pool_merkle_root(FpBlake3Pool *pool,
+                               const uint8_t *key,
+                               uint8_t *nodes,
+                               size_t count,
+                               uint8_t *root) {
+    if (merkle_span_for(pool, count) != 0 &&
+        arena_reserve(&pool->arena, (count / 2 + 1) * FP_BLAKE3_OUT_LEN,
+                      pool->cfg.huge_pages) != 0) {
+        return -1;
+    }
+    merkle_root_rec(pool, key, nodes, pool->arena.base, count, root);
+    return 0;
+}
+
+enum {
+    TUNE_BYTES = 32 * 1024 * 1024,
+    TUNE_TRIALS = 3,
+    TUNE_MIN_SUBTREE = 64,
+    TUNE_MAX_SUBTREE = 1024,
+    TUNE_MIN_PARALLEL = 256 * 1024,
+};
+
+static uint64_t now_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 /
+                      (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Best of trials; pool NULL times the serial path.
+static uint64_t tune_time_rec(FpBlake3Pool *pool,
+                              const uint8_t *input,
+                              size_t len,
+                              size_t trials,
+                              uint64_t best) {
+    if (trials == 0) {
+        return best;
+    }
+    FpBlake3StreamSet mode;
+    uint8_t out[FP_BLAKE3_OUT_LEN];
+    fp_blake3_stream_set_init(&mode);
+    uint64_t t0 = now_ns();
+    int err = pool ? fp_blake3_pool_hash(pool, &mode, input, len, out,
+                                         sizeof(out))
+                   : hash_serial(&mode, input, len, out, sizeof(out));
+    uint64_t dt = err == 0 ? now_ns() - t0 : UINT64_MAX;
+    return tune_time_rec(pool, input, len, trials - 1, dt < best ? dt : best);
+}
+
+// Times a pool built from cfg with the serial cutoff disabled.
+static uint64_t tune_pool_time(const FpBlake3PoolConfig *cfg,
+                               const uint8_t *input,
+                               size_t len) {
+    FpBlake3PoolConfig forced = *cfg;
+    forced.min_parallel_bytes = 0;
+    FpBlake3Pool *pool = fp_blake3_pool_create(&forced);
+    if (!pool) {
+        return UINT64_MAX;
+    }
+    uint64_t dt = tune_time_rec(pool, input, len, TUNE_TRIALS, UINT64_MAX);
+    fp_blake3_pool_destroy(pool);
+    return dt;
+}
+
+// Doubles the worker count up to the CPU count (which is always tried) and
+// keeps the fastest.
+static uint32_t tune_threads_rec(FpBlake3PoolConfig *cfg,
+                                 const uint8_t *input,
+                                 size_t cpus,
+                                 size_t threads,
+                                 uint32_t best_threads,
+                                 uint64_t best) {
+    if (threads > cpus) {
+        return best_threads;
+    }
+    cfg->threads = (uint32_t)threads;
+    uint64_t dt = tune_pool_time(cfg, input, TUNE_BYTES);
+    if (dt < best) {
+        best = dt;
+        best_threads = (uint32_t)threads;
+    }
+    size_t next = threads == cpus ? cpus + 1
+                  : (threads * 2 > cpus ? cpus : threads * 2);
+    return tune_threads_rec(cfg, input, cpus, next, best_threads, best);
+}
+
+static uint32_t tune_subtree_rec(FpBlake3PoolConfig *cfg,
+                                 const uint8_t *input,
+                                 uint32_t chunks,
+                                 uint32_t best_chunks,
+                                 uint64_t best) {
+    if (chunks > TUNE_MAX_SUBTREE) {
+        return best_chunks;
+    }
+    cfg->min_subtree_chunks = chunks;
+    uint64_t dt = tune_pool_time(cfg, input, TUNE_BYTES);
+    if (dt < best) {
+        return tune_subtree_rec(cfg, input, chunks * 2, chunks, dt);
+    }
+    return tune_subtree_rec(cfg, input, chunks * 2, best_chunks, best);
+}
+
+// Smallest input, doubling from TUNE_MIN_PARALLEL, that the pool hashes
+// faster than the calling thread alone.
+static uint64_t tune_crossover_rec(FpBlake3Pool *pool,
+                                   const uint8_t *input,
+                                   size_t len) {
+    if (len > TUNE_BYTES) {
+        return UINT64_MAX;
+    }
+    uint64_t serial = tune_time_rec(NULL, input, len, TUNE_TRIALS,
+                                    UINT64_MAX);
+    uint64_t parallel = tune_time_rec(pool, input, len, TUNE_TRIALS,
+                                      UINT64_MAX);
+    if (parallel < serial) {
+        return len;
+    }
+    return tune_crossover_rec(pool, input, len * 2);
+}
+
+int fp_blake3_pool_autotune(FpBlake3PoolConfig *cfg) {
+    FpBlake3PoolConfig tuned = *cfg;
+    uint8_t *input = (uint8_t *)malloc(TUNE_BYTES);
+    if (!input) {
+        return -1;
+    }
+    memset(input, 0xa5, TUNE_BYTES);
+    tuned.threads = tune_threads_rec(&tuned, input, online_cpus(), 1, 1,
+                                     UINT64_MAX);
+    tuned.min_subtree_chunks = tune_subtree_rec(&tuned, input,
+                                                TUNE_MIN_SUBTREE,
+                                                tuned.min_subtree_chunks,
+                                                UINT64_MAX);
+    tuned.min_parallel_bytes = UINT64_MAX;
+    if (tuned.threads > 1) {
+        FpBlake3PoolConfig forced = tuned;
+        forced.min_parallel_bytes = 0;
+        FpBlake3Pool *pool = fp_blake3_pool_create(&forced);
+        if (!pool) {
+            free(input);
+            return -1;
+        }
+        tuned.min_parallel_bytes = tune_crossover_rec(pool, input,
+                                                      TUNE_MIN_PARALLEL);
+        fp_blake3_pool_destroy(pool);
+    }
+    free(input);
+    *cfg = tuned;
+    return 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "fp_blake3_fast.h"
+
+#define FP_BLAKE3_POOL_MAX_NODES 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Parallel hashing of large inputs. The input is cut into power-of-two
+// subtrees. On Linux with numa set, each subtree goes to a worker pinned to
+// the node that owns its first page and other nodes only steal once their
+// own work runs out.
+typedef struct {
+    uint32_t threads;            // 0: one worker per CPU in the affinity mask
+    uint32_t min_subtree_chunks; // rounded up to a power of two
+    uint64_t min_parallel_bytes; // shorter inputs hash on the calling thread
+    int numa;                    // pin workers and place subtrees by node
+    int huge_pages;              // back the scratch with huge pages if possible
+} FpBlake3PoolConfig;
+
+typedef struct FpBlake3Pool FpBlake3Pool;
+
+void fp_blake3_pool_defaults(FpBlake3PoolConfig *cfg);
+// Times worker counts, subtree sizes and the serial/parallel crossover on
+// this host and writes the fastest into cfg, keeping numa and huge_pages.
+// Inputs never worth splitting get min_parallel_bytes = UINT64_MAX. Takes
+// a few seconds; returns -1 if the buffer or a pool can't be set up.
+int fp_blake3_pool_autotune(FpBlake3PoolConfig *cfg);
+// Starts the workers. Returns NULL if they can't be set up.
+FpBlake3Pool *fp_blake3_pool_create(const FpBlake3PoolConfig *cfg);
+void fp_blake3_pool_destroy(FpBlake3Pool *pool);
+// Number of workers and distinct NUMA nodes they ended up on.
+size_t fp_blake3_pool_threads(const FpBlake3Pool *pool);
+size_t fp_blake3_pool_nodes(const FpBlake3Pool *pool);
+// Hashes input in the given mode (NULL for plain hashing) and writes
+// output_len root bytes. Calls on one pool must not overlap. Returns -1 if
+// the scratch could not grow.
+int fp_blake3_pool_hash(FpBlake3Pool *pool,
+                        const FpBlake3StreamSet *mode,
+                        const uint8_t *input,
+                        size_t len,
+                        uint8_t *output,
+                        size_t output_len);
+// Same as fp_blake3_subtree_cv, with the subtree split across the workers.
+int fp_blake3_pool_subtree_cv(FpBlake3Pool *pool,
+                              const FpBlake3StreamSet *mode,
+                              const uint8_t *input,
+                              size_t len,
+                              uint64_t chunk_counter,
+                              uint32_t cv[8]);
+// Same as fp_blake3_merkle_level with the pairs split across the workers,
+// so out must not overlap nodes. Levels under min_parallel_bytes of nodes
+// are built on the calling thread.
+size_t fp_blake3_pool_merkle_level(FpBlake3Pool *pool,
+                                   const uint8_t *key,
+                                   const uint8_t *nodes,
+                                   size_t count,
+                                   uint8_t *out);
+// Same as fp_blake3_merkle_root. Large levels are built on the workers,
+// alternating between nodes and pool scratch, and nodes is overwritten.
+// Returns -1 if the scratch could not grow.
+int fp_blake3_pool_merkle_root(FpBlake3Pool *pool,
+                               const uint8_t *key,
+                               uint8_t *nodes,
+                               size_t count,
+                               uint8_t *root);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,24 +1,66 @@
+param(
+    [switch]$Stats,
+    [switch]$NoAsm
+)
+
 Set-StrictMode -Version Latest
 
 $gcc = "C:\msys64\mingw64\bin\gcc.exe"
+$gxx = "C:\msys64\mingw64\bin\g++.exe"
 $nasm = "C:\Users\baian\AppData\Local\bin\NASM\nasm.exe"
 $out = Join-Path $PSScriptRoot "fp_bench.exe"
+$hppTest = Join-Path $PSScriptRoot "fp_blake3_hpp_test.exe"
 $obj = Join-Path $PSScriptRoot "fp_blake3_compress.obj"
 $asmDir = Join-Path $PSScriptRoot "asm"
 $asm = Join-Path $asmDir "fp_blake3_compress.asm"
 $src = @(
     (Join-Path $PSScriptRoot "fp_bench.c"),
-    (Join-Path $PSScriptRoot "fp_blake3_fast.c")
+    (Join-Path $PSScriptRoot "fp_blake3_fast.c"),
+    (Join-Path $PSScriptRoot "fp_blake3_cdc.c"),
+    (Join-Path $PSScriptRoot "fp_blake3_file.c"),
+    (Join-Path $PSScriptRoot "fp_blake3_parallel.c")
 )
 
-& $nasm -f win64 -O2 -I $asmDir -o $obj $asm
-if ($LASTEXITCODE -ne 0) {
-    throw "NASM build failed"
+$objs = @()
+if (-not $NoAsm) {
+    & $nasm -f win64 -O2 -I $asmDir -o $obj $asm
+    if ($LASTEXITCODE -ne 0) {
+        throw "NASM build failed"
+    }
+    $objs += $obj
+}
+
+$cflags = @("-O3", "-mavx2", "-foptimize-sibling-calls", "-pthread")
+if ($Stats) {
+    $cflags += "-DFP_BLAKE3_STATS"
+}
+if ($NoAsm) {
+    $cflags += "-DFP_BLAKE3_NO_ASM"
 }
 
-& $gcc -O3 -mavx2 -foptimize-sibling-calls -I $PSScriptRoot -o $out @src $obj
+& $gcc @cflags -I $PSScriptRoot -o $out @src @objs
 if ($LASTEXITCODE -ne 0) {
     throw "GCC build failed"
 }
 
+$libObjs = @()
+foreach ($file in $src | Select-Object -Skip 1) {
+    $name = [IO.Path]::GetFileNameWithoutExtension($file) + ".o"
+    $libObj = Join-Path ([IO.Path]::GetTempPath()) $name
+    & $gcc @cflags -I $PSScriptRoot -c -o $libObj $file
+    if ($LASTEXITCODE -ne 0) {
+        throw "GCC build failed"
+    }
+    $libObjs += $libObj
+}
+& $gxx -std=c++20 @cflags -I $PSScriptRoot -o $hppTest `
+    (Join-Path $PSScriptRoot "fp_blake3_hpp_test.cpp") @libObjs @objs
+if ($LASTEXITCODE -ne 0) {
+    throw "G++ build failed"
+}
+& $hppTest
+if ($LASTEXITCODE -ne 0) {
+    throw "fp_blake3.hpp test failed"
+}
+
 & $out